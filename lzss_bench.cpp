@@ -0,0 +1,293 @@
+#include "lzss_cpp.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+#define DEFAULT_WARMUP 3
+#define DEFAULT_REPETITIONS 20
+
+typedef struct config_t
+{
+    uint8_t offset_bits;
+    uint8_t length_bits;
+    uint8_t minimum_length;
+} config_t;
+
+// The codec's own default first, then narrower and wider windows.
+static const config_t DEFAULT_GRID[] = {
+    {10, 6, 2},
+    {8, 4, 2},
+    {12, 4, 3},
+    {14, 5, 3},
+    {16, 8, 3},
+};
+
+typedef struct bench_options_t
+{
+    uint32_t warmup = DEFAULT_WARMUP;
+    uint32_t repetitions = DEFAULT_REPETITIONS;
+    int level = Lzss::DEFAULT_LEVEL;
+    uint8_t format = 0;
+    bool json = false;
+
+    std::vector<config_t> grid;
+    std::vector<std::string> files;
+} bench_options_t;
+
+typedef struct result_t
+{
+    std::string file;
+    config_t config;
+
+    uint64_t input_length;
+    uint64_t compressed_length;
+
+    // Seconds per run, sorted.
+    std::vector<double> encode_times;
+    std::vector<double> decode_times;
+
+#if LZSS_STATS
+    // Counters of one extra, untimed encode and decode.
+    lzss_stats_t stats;
+#endif
+} result_t;
+
+// Runs `phase` `warmup` times untimed, then `repetitions` times timed, and returns the sorted run times in seconds.
+template <typename Phase>
+static std::vector<double> time_phase(const bench_options_t &options, Phase &&phase)
+{
+    for (uint32_t i = 0; i < options.warmup; i += 1)
+        phase();
+
+    std::vector<double> times;
+    for (uint32_t i = 0; i < options.repetitions; i += 1)
+    {
+        auto start = std::chrono::steady_clock::now();
+        phase();
+        auto end = std::chrono::steady_clock::now();
+
+        times.push_back(std::chrono::duration<double>(end - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+// Nearest-rank percentile of sorted `times`.
+static double percentile(const std::vector<double> &times, uint32_t percent)
+{
+    size_t rank = (times.size() * percent + 99) / 100;
+    return times[rank == 0 ? 0 : rank - 1];
+}
+
+static double megabytes_per_second(uint64_t length, double seconds)
+{
+    return seconds > 0 ? length / seconds / 1e6 : 0;
+}
+
+// Times encode and decode of `input` on their own, each into a buffer allocated up front, so neither
+// allocation nor the round trip check below ends up in the numbers.
+static result_t bench(const bench_options_t &options, const std::string &file, Span<const uint8_t> input, const config_t &config)
+{
+    result_t result;
+    result.file = file;
+    result.config = config;
+    result.input_length = input.length;
+
+    lzss_dispatch(config.offset_bits, config.length_bits, config.minimum_length, options.level, [&](auto &lzss)
+    {
+        lzss.set_format(options.format);
+
+        std::vector<uint8_t> compressed(lzss.get_upper_bound(input.length));
+        std::vector<uint8_t> decompressed(input.length + MATCH_COPY_SLACK);
+
+        Span<uint8_t> encoded(compressed.data(), compressed.size());
+        size_t compressed_length = 0;
+
+        result.encode_times = time_phase(options, [&]() { compressed_length = lzss.encode(input, encoded); });
+
+        Span<const uint8_t> stream(compressed.data(), compressed_length);
+        Span<uint8_t> output(decompressed.data(), decompressed.size());
+        size_t decoded_length = 0;
+
+        result.decode_times = time_phase(options, [&]() { decoded_length = lzss.decode(stream, output); });
+
+        if (decoded_length != input.length || (input.length > 0 && memcmp(decompressed.data(), input.data, input.length) != 0))
+            throw std::logic_error("Round trip mismatch");
+
+#if LZSS_STATS
+        lzss_stats().reset();
+        lzss.decode(Span<const uint8_t>(compressed.data(), lzss.encode(input, encoded)), output);
+        result.stats = lzss_stats().snapshot();
+#endif
+
+        result.compressed_length = compressed_length;
+        return 0;
+    });
+
+    return result;
+}
+
+static void print_csv(const std::vector<result_t> &results)
+{
+    printf("file,offset_bits,length_bits,minimum_length,input_bytes,compressed_bytes,ratio,"
+           "encode_mbps,encode_p50_us,encode_p90_us,encode_p99_us,"
+           "decode_mbps,decode_p50_us,decode_p90_us,decode_p99_us\n");
+
+    for (const result_t &result : results)
+    {
+        printf("%s,%u,%u,%u,%llu,%llu,%.4f", result.file.c_str(), result.config.offset_bits, result.config.length_bits, result.config.minimum_length,
+               (unsigned long long)result.input_length, (unsigned long long)result.compressed_length,
+               result.input_length > 0 ? (double)result.compressed_length / result.input_length : 0.0);
+
+        for (const std::vector<double> *times : {&result.encode_times, &result.decode_times})
+        {
+            printf(",%.1f,%.1f,%.1f,%.1f", megabytes_per_second(result.input_length, percentile(*times, 50)),
+                   percentile(*times, 50) * 1e6, percentile(*times, 90) * 1e6, percentile(*times, 99) * 1e6);
+        }
+
+        printf("\n");
+    }
+}
+
+static void print_json(const std::vector<result_t> &results)
+{
+    printf("[\n");
+
+    for (size_t i = 0; i < results.size(); i += 1)
+    {
+        const result_t &result = results[i];
+
+        printf("  {\"file\": \"%s\", \"offset_bits\": %u, \"length_bits\": %u, \"minimum_length\": %u, \"input_bytes\": %llu, \"compressed_bytes\": %llu, \"ratio\": %.4f",
+               result.file.c_str(), result.config.offset_bits, result.config.length_bits, result.config.minimum_length,
+               (unsigned long long)result.input_length, (unsigned long long)result.compressed_length,
+               result.input_length > 0 ? (double)result.compressed_length / result.input_length : 0.0);
+
+        const char *phases[2] = {"encode", "decode"};
+        const std::vector<double> *times[2] = {&result.encode_times, &result.decode_times};
+
+        for (int phase = 0; phase < 2; phase += 1)
+        {
+            printf(", \"%s\": {\"mbps\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f}", phases[phase],
+                   megabytes_per_second(result.input_length, percentile(*times[phase], 50)),
+                   percentile(*times[phase], 50) * 1e6, percentile(*times[phase], 90) * 1e6, percentile(*times[phase], 99) * 1e6);
+        }
+
+#if LZSS_STATS
+        printf(", \"stats\": %s", lzss_stats_json(result.stats).c_str());
+#endif
+
+        printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+
+    printf("]\n");
+}
+
+// Parses a comma separated list of format option names into FORMAT_ flags, returns false for an unknown one.
+static bool parse_format(const char *value, uint8_t &format)
+{
+    std::string names(value);
+    format = 0;
+
+    for (size_t start = 0; start <= names.size();)
+    {
+        size_t end = MIN(names.find(',', start), names.size());
+        std::string name = names.substr(start, end - start);
+
+        if (name == "rep")
+            format |= FORMAT_REP_MATCHES;
+        else if (name == "ext")
+            format |= FORMAT_EXTENDED_LENGTHS;
+        else if (name != "none")
+            return false;
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+static void print_usage()
+{
+    std::cout << "Usage: lzss_bench [-w warmup] [-r repetitions] [-l level] [-c offset_bits,length_bits,minimum_length]... [-F none|rep,ext] [-f csv|json] [file...]\n";
+    std::cout << "Without files every file in corpus/ is measured, without -c a default grid of settings.\n";
+}
+
+int main(int argc, const char **argv)
+{
+    bench_options_t options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        const char *value = argv[arg + 1];
+        unsigned o, l, m;
+
+        if (strcmp(argv[arg], "-w") == 0)
+            options.warmup = strtoul(value, NULL, 10);
+        else if (strcmp(argv[arg], "-r") == 0)
+            options.repetitions = MAX(strtoul(value, NULL, 10), 1ul);
+        else if (strcmp(argv[arg], "-l") == 0)
+            options.level = atoi(value);
+        else if (strcmp(argv[arg], "-F") == 0 && parse_format(value, options.format))
+            ;
+        else if (strcmp(argv[arg], "-f") == 0 && (strcmp(value, "csv") == 0 || strcmp(value, "json") == 0))
+            options.json = strcmp(value, "json") == 0;
+        else if (strcmp(argv[arg], "-c") == 0 && sscanf(value, "%u,%u,%u", &o, &l, &m) == 3 && o >= 1 && o <= 31 && l >= 1 && l <= 31 && m >= 1)
+            options.grid.push_back({(uint8_t)o, (uint8_t)l, (uint8_t)m});
+        else
+        {
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (options.level < Lzss::MIN_LEVEL || options.level > Lzss::MAX_LEVEL)
+    {
+        print_usage();
+        return -1;
+    }
+
+    if (options.grid.empty())
+        options.grid.assign(std::begin(DEFAULT_GRID), std::end(DEFAULT_GRID));
+
+    for (; arg < argc; arg += 1)
+        options.files.push_back(argv[arg]);
+
+    if (options.files.empty())
+    {
+        for (const auto &entry : std::filesystem::directory_iterator("corpus"))
+        {
+            if (entry.is_regular_file())
+                options.files.push_back(entry.path().generic_string());
+        }
+
+        std::sort(options.files.begin(), options.files.end());
+    }
+
+    std::vector<result_t> results;
+
+    for (const std::string &file : options.files)
+    {
+        MappedFile mapped(file.c_str());
+
+        if (mapped.size() > 0xFFFFFFFF)
+        {
+            std::cerr << "Skipping " << file << ", raw streams hold at most 4 GiB\n";
+            continue;
+        }
+
+        for (const config_t &config : options.grid)
+            results.push_back(bench(options, file, mapped.bytes(), config));
+    }
+
+    if (options.json)
+        print_json(results);
+    else
+        print_csv(results);
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <memory.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -436,8 +437,53 @@ static error_t do_lzss_decoding(array_t input, array_t *output)
     return lzss_decode(config, input, output);
 }
 
+bool write_file(const char *file_name, array_t buffer)
+{
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL)
+        return false;
+
+    bool written = fwrite(buffer.bytes, sizeof(uint8_t), buffer.length, file) == buffer.length;
+
+    return fclose(file) == 0 && written;
+}
+
+// `-c input output` and `-d input output` encode or decode a single raw stream, for the conformance suite.
+static int convert_file(bool encode, const char *input_name, const char *output_name)
+{
+    array_t input = {0};
+    if (!read_file(input_name, &input))
+    {
+        printf("Error reading file %s\n", input_name);
+        return -1;
+    }
+
+    array_t output = {0};
+    error_t error = encode ? do_lzss_encoding(input, &output) : do_lzss_decoding(input, &output);
+
+    if (error != ERROR_ALL_GOOD && error != ERROR_NO_OP)
+    {
+        printf("Error %s file %d\n", encode ? "encoding" : "decoding", error);
+        return -1;
+    }
+
+    if (error == ERROR_NO_OP)
+        output.length = 0;
+
+    if (!write_file(output_name, output))
+    {
+        printf("Error writing file %s\n", output_name);
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, const char **argv)
 {
+    if (argc == 4 && (strcmp(argv[1], "-c") == 0 || strcmp(argv[1], "-d") == 0))
+        return convert_file(strcmp(argv[1], "-c") == 0, argv[2], argv[3]);
+
     if (argc != 2)
     {
         printf("Expected a filename\n");
@@ -0,0 +1,250 @@
+# Conformance and throughput suite for the ports. Every port is run as a process on every corpus file, or
+# the files given:
+#
+# - Streams: the ports with the original brute force greedy parse, the C++ ones without -l included, have
+#   to write the same bytes, and the ones recorded in the baseline. The C++ codec's levels parse
+#   differently by design, so their streams are only held to the baseline's sizes: a parse may change,
+#   but not write more bytes than the recorded one.
+# - Decoding: every port has to decode every distinct stream written for a file back to the file.
+# - Throughput: best of `runs` wall clock times per file, process start included, summed over the corpus
+#   into encode and decode MB/s, which must stay within `tolerance` of the baseline when run on its files.
+#
+# Ports are found by the names of the binaries the Makefile builds, missing ones are skipped. Zig, Odin
+# and .NET have no raw stream mode yet. The baseline is machine specific, -u records a new one.
+
+import argparse
+import hashlib
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+BASELINE = "conformance_baseline.json"
+
+DEFAULT_RUNS = 3
+DEFAULT_TOLERANCE = 0.2
+
+# name: (command, extra flags for the raw stream mode, extra flags when encoding, whether it uses the reference parse)
+PORTS = {
+    "gcc": (["lzss_gcc.exe"], [], [], True),
+    "clang": (["lzss_clang.exe"], [], [], True),
+    "zigcc": (["lzss_zigcc.exe"], [], [], True),
+    "tcc": (["lzss_tcc.exe"], [], [], True),
+    "g++": (["lzss_g++.exe"], ["-r"], [], True),
+    "clang++": (["lzss_clang++.exe"], ["-r"], [], True),
+    "zigc++": (["lzss_zigc++.exe"], ["-r"], [], True),
+    "g++-l3": (["lzss_g++.exe"], ["-r"], ["-l", "3"], False),
+    "clang++-l3": (["lzss_clang++.exe"], ["-r"], ["-l", "3"], False),
+    "zigc++-l3": (["lzss_zigc++.exe"], ["-r"], ["-l", "3"], False),
+    "rust": (["lzss_rust.exe"], [], [], True),
+    "go": (["lzss_go.exe" if os.path.exists("lzss_go.exe") else "lzss_go"], [], [], True),
+    "node": (["node", "lzss_js.js"], [], [], True),
+    "python": ([sys.executable, "lzss_py.py"], [], [], True),
+}
+
+# Python takes seconds per corpus file, it only runs when asked for.
+DEFAULT_PORTS = [name for name in PORTS if name != "python"]
+
+
+def is_available(name):
+    command = PORTS[name][0]
+
+    if command[0] in ("node", sys.executable):
+        return shutil.which(command[0]) is not None and os.path.exists(command[1])
+
+    return os.path.exists(command[0])
+
+
+def get_command(name, mode, input_name, output_name):
+    command, flags, encode_flags, _ = PORTS[name]
+
+    if mode == "-c":
+        flags = flags + encode_flags
+
+    if not command[0] in ("node", sys.executable):
+        command = [os.path.join(".", command[0])] + command[1:]
+
+    return command + [mode] + flags + [input_name, output_name]
+
+
+# Runs the port `runs` times, returns the best time in seconds, or None if it failed.
+def run(name, mode, input_name, output_name, runs):
+    best = None
+
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = subprocess.run(get_command(name, mode, input_name, output_name), stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        seconds = time.perf_counter() - start
+
+        if result.returncode != 0:
+            return None
+
+        best = seconds if best is None else min(best, seconds)
+
+    return best
+
+
+def read_bytes(file_name):
+    with open(file_name, "rb") as file:
+        return file.read()
+
+
+def megabytes_per_second(length, seconds):
+    return length / seconds / 1e6 if seconds > 0 else 0.0
+
+
+def check(options, files, baseline, scratch):
+    failures = []
+    results = {}
+
+    for name in options.ports:
+        results[name] = {"encode_seconds": 0.0, "decode_seconds": 0.0, "files": {}}
+
+    for file_name in files:
+        original = read_bytes(file_name)
+        streams = {}
+
+        for name in options.ports:
+            stream_name = os.path.join(scratch, "%s.%s.lz" % (os.path.basename(file_name), name))
+            seconds = run(name, "-c", file_name, stream_name, options.runs)
+
+            if seconds is None:
+                failures.append("%s: %s failed to encode it" % (file_name, name))
+                continue
+
+            stream = read_bytes(stream_name)
+            digest = hashlib.sha256(stream).hexdigest()
+
+            results[name]["encode_seconds"] += seconds
+            results[name]["files"][file_name] = {"compressed_bytes": len(stream), "sha256": digest}
+            streams.setdefault(digest, stream_name)
+
+            recorded = baseline.get(name, {}).get("files", {}).get(file_name)
+            if recorded is None or options.update:
+                pass
+            elif PORTS[name][3] and recorded["sha256"] != digest:
+                failures.append("%s: %s wrote a different stream than the baseline, %d bytes, recorded %d" %
+                                (file_name, name, len(stream), recorded["compressed_bytes"]))
+            elif len(stream) > recorded["compressed_bytes"]:
+                failures.append("%s: %s wrote %d bytes, more than the baseline's %d" %
+                                (file_name, name, len(stream), recorded["compressed_bytes"]))
+
+        references = set(results[name]["files"][file_name]["sha256"] for name in options.ports
+                         if PORTS[name][3] and file_name in results[name]["files"])
+        if len(references) > 1:
+            failures.append("%s: the reference parse ports wrote %d different streams" % (file_name, len(references)))
+
+        # Every distinct stream is decoded by every port, the port's own one timed.
+        decoded_name = os.path.join(scratch, os.path.basename(file_name) + ".out")
+
+        for name in options.ports:
+            own = results[name]["files"].get(file_name, {}).get("sha256")
+
+            for digest, stream_name in streams.items():
+                seconds = run(name, "-d", stream_name, decoded_name, options.runs if digest == own else 1)
+
+                if seconds is None or read_bytes(decoded_name) != original:
+                    failures.append("%s: %s failed to decode %s" % (file_name, name, os.path.basename(stream_name)))
+                elif digest == own:
+                    results[name]["decode_seconds"] += seconds
+
+    return results, failures
+
+
+def report(options, files, results, baseline, failures):
+    total = sum(os.path.getsize(file_name) for file_name in files)
+
+    print("%-10s %12s %12s %12s %12s" % ("port", "encode MB/s", "baseline", "decode MB/s", "baseline"))
+
+    for name in options.ports:
+        row = [name]
+
+        # Small files are mostly process start, so the sums only compare over the same files.
+        comparable = set(baseline.get(name, {}).get("files", {})) == set(files)
+
+        for phase in ("encode", "decode"):
+            mbps = megabytes_per_second(total, results[name][phase + "_seconds"])
+            recorded = baseline.get(name, {}).get(phase + "_mbps") if comparable else None
+
+            results[name][phase + "_mbps"] = round(mbps, 2)
+            row += ["%.2f" % mbps, "-" if recorded is None else "%.2f" % recorded]
+
+            if recorded is not None and mbps < recorded * (1 - options.tolerance) and not options.update:
+                failures.append("%s: %s at %.2f MB/s, %.0f%% below the baseline's %.2f" %
+                                (name, phase, mbps, (1 - mbps / recorded) * 100, recorded))
+
+        print("%-10s %12s %12s %12s %12s" % tuple(row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Checks that the ports agree on the raw stream and compares their throughput with a baseline.")
+    parser.add_argument("-p", "--ports", help="comma separated ports, default every built one but python")
+    parser.add_argument("-r", "--runs", type=int, default=DEFAULT_RUNS, help="timed runs per file and phase, the best one counts")
+    parser.add_argument("-t", "--tolerance", type=float, default=DEFAULT_TOLERANCE, help="allowed throughput drop, as a fraction")
+    parser.add_argument("-b", "--baseline", default=BASELINE)
+    parser.add_argument("-u", "--update", action="store_true", help="record this run's streams and throughput as the baseline")
+    parser.add_argument("files", nargs="*", help="default every file in corpus/")
+    options = parser.parse_args()
+
+    requested = [name for name in (options.ports or "").split(",") if name]
+    unknown = [name for name in requested if name not in PORTS]
+    if unknown:
+        parser.error("unknown port %s, expected one of %s" % (", ".join(unknown), ", ".join(PORTS)))
+
+    options.ports = [name for name in requested or DEFAULT_PORTS if is_available(name)]
+    options.runs = max(options.runs, 1)
+
+    for name in requested:
+        if name not in options.ports:
+            print("Skipping %s, not built" % name)
+
+    if not options.ports:
+        print("No ports to check")
+        return 1
+
+    files = options.files or sorted(os.path.join("corpus", name).replace("\\", "/") for name in os.listdir("corpus")
+                                    if os.path.isfile(os.path.join("corpus", name)))
+
+    document = {}
+    if os.path.exists(options.baseline):
+        with open(options.baseline) as file:
+            document = json.load(file)
+
+    baseline = document.get("ports", {})
+
+    scratch = tempfile.mkdtemp(prefix="lzss_conformance")
+    try:
+        results, failures = check(options, files, baseline, scratch)
+    finally:
+        shutil.rmtree(scratch, ignore_errors=True)
+
+    report(options, files, results, baseline, failures)
+
+    if failures:
+        print("\n%d failures:" % len(failures))
+        for failure in failures:
+            print("  " + failure)
+        return 1
+
+    if options.update:
+        for name in options.ports:
+            baseline[name] = {
+                "encode_mbps": results[name]["encode_mbps"],
+                "decode_mbps": results[name]["decode_mbps"],
+                "files": results[name]["files"],
+            }
+
+        with open(options.baseline, "w") as file:
+            json.dump({"runs": options.runs, "ports": baseline}, file, indent=2, sort_keys=True)
+            file.write("\n")
+
+        print("\nWrote %s" % options.baseline)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,349 +1,587 @@
-#include <iostream>
-#include <stdexcept>
-#include <cstdint>
+#include "lzss_cpp.hpp"
 
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Blocks `-c` reads, encodes and writes at a time. They are linked, so the size only sets memory and how
+// much work every thread gets, not the ratio.
+#define CLI_BLOCK_SIZE (1 << 20)
+
+// Chunks `-d` reads and writes at a time.
+#define CLI_CHUNK_SIZE (1 << 20)
+
+// Buffers circulating through each pipeline: one per stage, so reading, coding and writing all overlap.
+#define CLI_BUFFERS 3
+
+// Blocking queue between two pipeline stages. Once closed, `pop` drains what is left and then returns false.
 template <typename T>
-class Array
+class Channel
 {
 private:
-    T *buffer;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool closed = false;
 
 public:
-    Array(uint32_t length)
+    void push(T item)
     {
-        this->buffer = new T[length];
-        this->length = length;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->items.push_back(std::move(item));
+        this->ready.notify_one();
     }
 
-    uint32_t length;
-
-    T &operator[](std::size_t idx) { return this->buffer[idx]; }
-    const T &operator[](std::size_t idx) const { return this->buffer[idx]; }
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+        this->ready.notify_all();
+    }
 
-    T *get_buffer()
+    bool pop(T &item)
     {
-        return this->buffer;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->ready.wait(lock, [&] { return !this->items.empty() || this->closed; });
+
+        if (this->items.empty())
+            return false;
+
+        item = std::move(this->items.front());
+        this->items.pop_front();
+        return true;
     }
 };
 
-class BitStream
+// The reader and writer threads of a pipeline. A stage that fails records why and sets `failed`, which
+// makes the others stop early and the writer leave off the end marker, so a broken output never looks whole.
+class Pipeline
 {
 private:
-    Array<uint8_t> buffer;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::exception_ptr error;
 
-    uint32_t buffer_length;
+public:
+    std::atomic<bool> failed{false};
+
+    // Runs `stage` on a thread of its own, then `done` whether it returned or threw.
+    template <typename Stage, typename Done>
+    void start(Stage &&stage, Done &&done)
+    {
+        this->threads.emplace_back([this, stage, done]() mutable
+        {
+            try
+            {
+                stage();
+            }
+            catch (...)
+            {
+                this->fail(std::current_exception());
+            }
 
-    uint8_t byte_buffer;
-    uint8_t bit_count;
+            done();
+        });
+    }
 
-public:
-    BitStream(Array<uint8_t> buffer) : buffer(buffer)
+    void fail(std::exception_ptr error)
     {
-        this->buffer_length = buffer.length;
-        this->buffer_position = 0;
-        this->byte_buffer = 0;
-        this->bit_count = 0;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->error)
+            this->error = error;
+
+        this->failed = true;
     }
 
-    uint32_t buffer_position;
+    // Waits for every stage and rethrows the first error any of them ran into.
+    void finish()
+    {
+        for (auto &thread : this->threads)
+            thread.join();
+        this->threads.clear();
+
+        if (this->error)
+            std::rethrow_exception(this->error);
+    }
+};
 
-    void flush()
+static FILE *open_file(const char *path, bool write)
+{
+    if (strcmp(path, "-") == 0)
     {
-        if (this->bit_count == 0)
-            return;
+        FILE *file = write ? stdout : stdin;
+#ifdef _WIN32
+        _setmode(_fileno(file), _O_BINARY);
+#endif
+        return file;
+    }
 
-        if (this->bit_count < 8)
-            this->byte_buffer <<= (8 - this->bit_count);
+    FILE *file = fopen(path, write ? "wb" : "rb");
+    if (file == NULL)
+        throw std::invalid_argument(std::string("Could not open ") + path);
 
-        if (this->buffer_position >= this->buffer_length)
-            throw std::out_of_range("buffer");
+    return file;
+}
 
-        this->buffer[this->buffer_position++] = this->byte_buffer;
-        this->byte_buffer = 0;
-        this->bit_count = 0;
-    }
+static void close_file(FILE *file)
+{
+    if (file != stdin && file != stdout)
+        fclose(file);
+}
+
+// Reads until `length` bytes or the end of the input, returns how many it got.
+static size_t read_bytes(FILE *file, uint8_t *bytes, size_t length)
+{
+    size_t count = fread(bytes, 1, length, file);
+
+    if (count < length && ferror(file))
+        throw std::logic_error("Could not read input");
+
+    return count;
+}
+
+static void write_bytes(FILE *file, const uint8_t *bytes, size_t length)
+{
+    if (length > 0 && fwrite(bytes, 1, length, file) != length)
+        throw std::logic_error("Could not write output");
+}
 
-    void unflush()
+typedef struct block_t
+{
+    // The last `max_offset` bytes of the block before, then this block's `length` bytes.
+    std::vector<uint8_t> window;
+    uint32_t history;
+    uint32_t length;
+
+    std::vector<uint8_t> encoded;
+    size_t encoded_size;
+    uint32_t checksum;
+} block_t;
+
+typedef struct batch_t
+{
+    std::vector<block_t> blocks;
+    uint32_t count;
+} batch_t;
+
+// Writes `input` as a streamed frame with checksums, the same LzssEncoder writes, but with a reader thread filling
+// batches of blocks, the pool encoding one batch at a time and a writer thread writing them out as they come.
+// Every block's checksum is taken by the thread that encodes it, the writer combines them into the content's.
+template <typename Codec>
+static void compress(const Codec &lzss, FILE *input, FILE *output, ThreadPool &pool)
+{
+    uint32_t max_offset = lzss.get_max_offset();
+
+    Channel<std::unique_ptr<batch_t>> free_batches, read_batches, encoded_batches;
+
+    for (uint32_t i = 0; i < CLI_BUFFERS; i += 1)
     {
-        if (this->buffer_position < this->buffer_length)
+        std::unique_ptr<batch_t> batch(new batch_t());
+        batch->blocks.resize(pool.size());
+        batch->count = 0;
+
+        for (block_t &block : batch->blocks)
         {
-            this->byte_buffer = this->buffer[this->buffer_position++];
-            this->bit_count = 8;
+            block.window.resize(max_offset + CLI_BLOCK_SIZE);
+            block.encoded.resize(STREAM_BLOCK_HEADER_SIZE + lzss.get_upper_bound(CLI_BLOCK_SIZE) + CHECKSUM_SIZE);
         }
-        else
-            throw std::out_of_range("buffer");
+
+        free_batches.push(std::move(batch));
     }
 
-    bool read_bit()
+    Pipeline pipeline;
+
+    pipeline.start([&]()
     {
-        if (this->bit_count == 0)
-            this->unflush();
+        std::vector<uint8_t> tail;
+        bool end = false;
 
-        this->bit_count -= 1;
+        for (std::unique_ptr<batch_t> batch; !end && !pipeline.failed && free_batches.pop(batch);)
+        {
+            batch->count = 0;
 
-        return (this->byte_buffer & (1 << (this->bit_count))) > 0;
-    }
+            for (; batch->count < batch->blocks.size() && !end; batch->count += 1)
+            {
+                block_t &block = batch->blocks[batch->count];
 
-    void write_bit(bool bit)
-    {
-        this->byte_buffer <<= 1;
-        this->byte_buffer |= bit ? 1 : 0;
+                std::copy(tail.begin(), tail.end(), block.window.begin());
+                block.history = tail.size();
+                block.length = read_bytes(input, &block.window[block.history], CLI_BLOCK_SIZE);
 
-        this->bit_count += 1;
+                end = block.length < CLI_BLOCK_SIZE;
 
-        if (this->bit_count == 8)
-            this->flush();
-    }
+                if (block.length == 0)
+                    break;
+
+                uint32_t total = block.history + block.length;
+                uint32_t keep = MIN(total, max_offset);
+                tail.assign(block.window.begin() + total - keep, block.window.begin() + total);
+            }
+
+            if (batch->count > 0)
+                read_batches.push(std::move(batch));
+        }
+    }, [&]() { read_batches.close(); });
 
-    uint32_t read_uint32(uint8_t bits)
+    pipeline.start([&]()
     {
-        uint32_t number = 0;
-        for (uint32_t i = 0; i < bits; i += 1)
+        uint8_t header[FRAME_HEADER_SIZE];
+        uint8_t flags = FRAME_FLAG_LINKED | FRAME_FLAG_STREAMED | FRAME_FLAG_CHECKSUMS | lzss.get_format();
+        write_frame_header(header, flags, lzss.get_offset_bits(), lzss.get_length_bits(), lzss.get_minimum_length(), CLI_BLOCK_SIZE);
+        write_bytes(output, header, sizeof(header));
+
+        uint32_t content_checksum = 0;
+
+        for (std::unique_ptr<batch_t> batch; encoded_batches.pop(batch);)
         {
-            number <<= 1;
+            if (pipeline.failed)
+                continue;
+
+            for (uint32_t i = 0; i < batch->count; i += 1)
+            {
+                const block_t &block = batch->blocks[i];
 
-            bool bit = this->read_bit();
+                write_bytes(output, block.encoded.data(), block.encoded_size);
+                content_checksum = crc32c_combine(content_checksum, block.checksum, block.length);
+            }
 
-            number |= bit ? 1 : 0;
+            free_batches.push(std::move(batch));
         }
 
-        return number;
-    }
+        if (!pipeline.failed)
+        {
+            uint8_t end[1 + CHECKSUM_SIZE] = {BLOCK_TYPE_END};
+            _store_uint32_le(end + 1, content_checksum);
+            write_bytes(output, end, sizeof(end));
+
+            if (fflush(output) != 0)
+                throw std::logic_error("Could not write output");
+        }
+    }, [&]() { free_batches.close(); });
 
-    void write_uint32(uint32_t number, uint8_t bits)
+    try
     {
-        while (bits > 0)
+        for (std::unique_ptr<batch_t> batch; read_batches.pop(batch);)
         {
-            uint32_t mask = 1 << (bits - 1);
-            bool bit = (number & mask) > 0;
+            pool.parallel_for(batch->count, [&](uint32_t i)
+            {
+                block_t &block = batch->blocks[i];
+                Span<const uint8_t> window(block.window.data(), block.history + block.length);
 
-            this->write_bit(bit);
+                block.encoded_size = lzss.encode_stream_block(window, block.history, Span<uint8_t>(block.encoded.data(), block.encoded.size()), &block.checksum);
+            });
 
-            bits -= 1;
+            encoded_batches.push(std::move(batch));
         }
     }
+    catch (...)
+    {
+        pipeline.fail(std::current_exception());
+        free_batches.close();
+    }
+
+    encoded_batches.close();
+    pipeline.finish();
+}
+
+typedef struct chunk_t
+{
+    std::vector<uint8_t> bytes;
+    size_t length;
+} chunk_t;
+
+// Decodes a streamed frame with LzssDecoder from the chunks the reader hands over, `first` of them already
+// taken, into chunks for the writer. Decoding is sequential, since every block may reference the one before
+// it, but no longer waits on either disk.
+template <typename Codec>
+static void decode_chunks(const Codec &lzss, std::unique_ptr<chunk_t> first, Channel<std::unique_ptr<chunk_t>> &read_chunks, Channel<std::unique_ptr<chunk_t>> &free_chunks,
+                          Channel<std::unique_ptr<chunk_t>> &decoded_chunks, Channel<std::unique_ptr<chunk_t>> &free_outputs)
+{
+    LzssDecoder<Codec> decoder(lzss);
+    std::unique_ptr<chunk_t> input = std::move(first), output;
+    size_t position = 0;
+
+    if (!free_outputs.pop(output))
+        throw std::logic_error("Could not write output");
+    output->length = 0;
 
-    // Reads an uint32 using 7-bit VLQ approach
-    uint32_t read_7bit_uint32()
+    while (!decoder.done())
     {
-        uint32_t number = 0;
-        uint32_t shift = 0;
-        while (true)
+        if (position == input->length)
         {
-            uint8_t byte = this->read_uint32(8);
-            number |= (byte & 127) << shift;
-            shift += 7;
+            free_chunks.push(std::move(input));
+            position = 0;
 
-            if ((byte & 128) == 0 || shift > 32)
-                break;
+            if (!read_chunks.pop(input))
+                throw std::out_of_range("stream");
         }
 
-        return number;
-    }
+        position += decoder.push(Span<const uint8_t>(input->bytes.data() + position, input->length - position));
 
-    // Writes an uint32 using 7-bit VLQ approach
-    void write_7bit_uint32(uint32_t number)
-    {
-        while (number > 127)
+        for (size_t pulled; (pulled = decoder.pull(Span<uint8_t>(output->bytes.data() + output->length, output->bytes.size() - output->length))) > 0;)
         {
-            uint32_t b = 128 | (number & 127); // Set the first bit as 1
-            this->write_uint32(b, 8);
-            number >>= 7;
-        }
+            output->length += pulled;
 
-        if (number > 0)
-            this->write_uint32(number & 127, 8);
-    }
-};
+            if (output->length == output->bytes.size())
+            {
+                decoded_chunks.push(std::move(output));
 
-typedef struct match_t
-{
-    uint32_t offset;
-    uint32_t length;
-} match_t;
+                if (!free_outputs.pop(output))
+                    throw std::logic_error("Could not write output");
+                output->length = 0;
+            }
+        }
+    }
 
-#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+    // The frame ends at its end marker, anything the input holds after that is not part of it.
+    bool trailing = position < input->length;
+    free_chunks.push(std::move(input));
 
-static inline match_t _create_match(uint32_t offset, uint32_t length)
-{
-    match_t match = {0};
+    while (!trailing && read_chunks.pop(input))
+    {
+        trailing = input->length > 0;
+        free_chunks.push(std::move(input));
+    }
 
-    match.offset = offset;
-    match.length = length;
+    if (trailing)
+        throw std::invalid_argument("Trailing data after the end of the stream");
 
-    return match;
+    if (output->length > 0)
+        decoded_chunks.push(std::move(output));
 }
 
-class Lzss
+// Runs `decode_chunks` between a reader and a writer thread, with a codec for the widths and format in the
+// frame header at the start of the first chunk read.
+static void decompress(FILE *input, FILE *output)
 {
-private:
-    uint8_t offset_bits;
-    uint8_t length_bits;
-
-    uint32_t max_offset;
-    uint32_t minimum_length;
-    uint32_t maximum_length;
+    Channel<std::unique_ptr<chunk_t>> free_chunks, read_chunks, decoded_chunks, free_outputs;
 
-    match_t get_longest_match(Array<uint8_t> input, uint32_t index)
+    for (uint32_t i = 0; i < CLI_BUFFERS; i += 1)
     {
-        if (index + this->minimum_length >= input.length)
-            return _create_match(0, 0);
+        free_chunks.push(std::unique_ptr<chunk_t>(new chunk_t{std::vector<uint8_t>(CLI_CHUNK_SIZE), 0}));
+        free_outputs.push(std::unique_ptr<chunk_t>(new chunk_t{std::vector<uint8_t>(CLI_CHUNK_SIZE), 0}));
+    }
 
-        uint32_t best_offset = 0, best_length = 0;
-        uint32_t offset = (this->max_offset > index) ? 0 : index - this->max_offset;
+    Pipeline pipeline;
+
+    pipeline.start([&]()
+    {
+        bool end = false;
 
-        while (offset < index && offset < input.length)
+        for (std::unique_ptr<chunk_t> chunk; !end && !pipeline.failed && free_chunks.pop(chunk);)
         {
-            uint32_t length = 0;
+            chunk->length = read_bytes(input, chunk->bytes.data(), chunk->bytes.size());
+            end = chunk->length < chunk->bytes.size();
 
-            while (offset + length < input.length && index + length < input.length && input[offset + length] == input[index + length])
-                length += 1;
+            read_chunks.push(std::move(chunk));
+        }
+    }, [&]() { read_chunks.close(); });
 
-            // We compare greater or equal, since a lower offset is better
-            if (length >= best_length)
-            {
-                best_length = length;
-                best_offset = offset;
-            }
+    pipeline.start([&]()
+    {
+        // After a failure chunks are still handed back, the decoder may be waiting on one to finish draining
+        // what was read before it stops.
+        for (std::unique_ptr<chunk_t> chunk; decoded_chunks.pop(chunk);)
+        {
+            if (!pipeline.failed)
+                write_bytes(output, chunk->bytes.data(), chunk->length);
 
-            offset += 1;
+            free_outputs.push(std::move(chunk));
         }
 
-        // Substract the found offset from the actual index to get the resulting offset.
-        return _create_match(index - best_offset, MIN(best_length, this->maximum_length));
-    }
+        if (!pipeline.failed && fflush(output) != 0)
+            throw std::logic_error("Could not write output");
+    }, [&]() { free_outputs.close(); });
 
-public:
-    Lzss(uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length)
+    try
     {
-        this->offset_bits = offset_bits;
-        this->max_offset = (1 << offset_bits) - 1;
+        std::unique_ptr<chunk_t> first;
+        if (!read_chunks.pop(first))
+            throw std::logic_error("Could not read input");
 
-        this->minimum_length = minimum_length;
-        this->length_bits = length_bits;
-        this->maximum_length = (1 << length_bits) - 1;
-    }
+        // A whole chunk is read before it is handed on, so it holds the header unless the input is shorter.
+        frame_info_t frame = read_frame_header(Span<const uint8_t>(first->bytes.data(), first->length));
+        if (!(frame.flags & FRAME_FLAG_STREAMED))
+            throw std::invalid_argument("Expected a streamed frame, as written by -c");
 
-    uint32_t get_upper_bound(uint32_t input_length)
-    {
-        // We sum all bits in the worst case scenario: 32 for the total input length and input_lenght * 9 (literal flag + byte)
-        uint32_t total_bits = 32 + input_length * 9;
+        if (frame.offset_bits < 1 || frame.offset_bits > 31 || frame.length_bits < 1 || frame.length_bits > 31 || frame.minimum_length < 1)
+            throw std::invalid_argument("Unsupported field widths in the frame header");
 
-        // If it's divisible by 8, we return the length. If not we sum 1 to account for the extra bits.
-        return (total_bits / 8) + ((total_bits % 8 > 0) ? 1 : 0);
+        lzss_dispatch(frame.offset_bits, frame.length_bits, frame.minimum_length, Lzss::DEFAULT_LEVEL, [&](auto &lzss)
+        {
+            lzss.set_format(frame.flags & FORMAT_FLAGS);
+            decode_chunks(lzss, std::move(first), read_chunks, free_chunks, decoded_chunks, free_outputs);
+            return 0;
+        });
     }
+    catch (...)
+    {
+        pipeline.fail(std::current_exception());
+    }
+
+    free_chunks.close();
+    decoded_chunks.close();
+    pipeline.finish();
+}
+
+// Encodes or decodes the whole input as one raw stream, the format the other ports read and write, in memory.
+template <typename Codec>
+static void convert_raw(const Codec &lzss, bool encode, FILE *input, FILE *output)
+{
+    std::vector<uint8_t> bytes;
 
-    Array<uint8_t> encode(Array<uint8_t> input)
+    for (size_t length = 0;; length = bytes.size())
     {
-        Array<uint8_t> output(get_upper_bound(input.length));
+        bytes.resize(length + CLI_CHUNK_SIZE);
 
-        BitStream stream(output);
+        size_t count = read_bytes(input, bytes.data() + length, CLI_CHUNK_SIZE);
+        bytes.resize(length + count);
 
-        stream.write_7bit_uint32(input.length);
+        if (count < CLI_CHUNK_SIZE)
+            break;
+    }
 
-        for (uint32_t index = 0; index < input.length;)
-        {
-            match_t match = this->get_longest_match(input, index);
+    Span<const uint8_t> span(bytes.data(), bytes.size());
+    Array<uint8_t> converted = encode ? lzss.encode(span) : lzss.decode(span);
 
-            if (match.length >= this->minimum_length)
-            {
-                stream.write_bit(true);
-                stream.write_uint32(match.offset, this->offset_bits);
-                stream.write_uint32(match.length, this->length_bits);
-                index += match.length;
-            }
-            else
-            {
-                stream.write_bit(false);
-                stream.write_uint32(input[index], 8);
-                index += 1;
-            }
-        }
+    write_bytes(output, converted.get_buffer(), converted.length);
 
-        stream.flush();
-        output.length = stream.buffer_position;
+    if (fflush(output) != 0)
+        throw std::logic_error("Could not write output");
+}
 
-        return output;
-    }
+// Encodes and decodes `file_name` in memory and checks the round trip.
+static int round_trip(const char *file_name)
+{
+    MappedFile file(file_name);
+    Span<const uint8_t> input = file.bytes();
 
-    Array<uint8_t> decode(Array<uint8_t> input)
+    return lzss_dispatch(10, 6, 2, Lzss::DEFAULT_LEVEL, [&](auto &lzss)
     {
-        BitStream stream(input);
-        uint32_t original_length = stream.read_7bit_uint32();
-        Array<uint8_t> output(original_length);
+        auto compressed = lzss.encode(input);
+
+        auto uncompressed = lzss.decode(compressed);
 
-        for (uint32_t index = 0; index < original_length;)
+        for (uint32_t i = 0; i < input.length; i++)
         {
-            bool is_pair = stream.read_bit();
-            if (is_pair)
-            {
-                uint32_t offset = stream.read_uint32(this->offset_bits);
-                uint32_t length = stream.read_uint32(this->length_bits);
-                for (uint32_t i = 0; i < length; i += 1)
-                    output[index + i] = output[(index - offset) + i];
-                index += length;
-            }
-            else
+            if (input[i] != uncompressed[i])
             {
-                auto literal = stream.read_uint32(8);
-                output[index] = literal & 0xFF;
-                index += 1;
+                std::cout << "Byte mismatch at byte " << i << "\n";
+                return -1;
             }
         }
 
-        return output;
-    }
-};
+        return 0;
+    });
+}
 
-Array<uint8_t> read_file(const char *file_name)
+static void print_usage()
 {
-    FILE *file = fopen(file_name, "rb");
-    if (file == NULL)
-        throw std::invalid_argument("file_name");
-
-    fseek(file, 0, SEEK_END);      // Seek to the end of the file
-    uint32_t length = ftell(file); // Get how many bytes the file contains
-    fseek(file, 0, SEEK_SET);      // Rewind the file pointer to 0
-
-    Array<uint8_t> buffer(length);
+    std::cout << "Usage: lzss_g++ file\n";
+    std::cout << "       lzss_g++ -c [-r] [-l level] [-t threads] input output\n";
+    std::cout << "       lzss_g++ -d [-r] input output\n";
+    std::cout << "A single file is encoded and decoded in memory as a check. -c compresses into a streamed frame with\n";
+    std::cout << "checksums, -d decompresses and verifies one. - reads stdin or writes stdout, -t 0 uses every hardware thread.\n";
+    std::cout << "-r reads and writes a single raw stream with the 10,6,2 widths instead, the format the other ports use,\n";
+    std::cout << "and without -l encodes with their parse, so the stream is byte for byte theirs.\n";
+}
 
-    uint32_t read_value = fread(buffer.get_buffer(), sizeof(uint8_t), buffer.length, file);
+int main(int argc, const char **argv)
+{
+    if (argc == 2 && argv[1][0] != '-')
+        return round_trip(argv[1]);
 
-    if (read_value != buffer.length)
+    if (argc < 4 || (strcmp(argv[1], "-c") != 0 && strcmp(argv[1], "-d") != 0))
     {
-        buffer.~Array();
-        fclose(file);
-        throw std::logic_error("Could not read file");
+        print_usage();
+        return -1;
     }
 
-    fclose(file);
+    bool encode = strcmp(argv[1], "-c") == 0;
+    int level = Lzss::DEFAULT_LEVEL;
+    bool leveled = false;
+    uint32_t threads = 0;
+    bool raw = false;
+    int arg = 2;
 
-    return buffer;
-}
+    while (arg + 2 < argc)
+    {
+        if (strcmp(argv[arg], "-r") == 0)
+        {
+            raw = true;
+            arg += 1;
+        }
+        else if (encode && strcmp(argv[arg], "-l") == 0)
+        {
+            level = atoi(argv[arg + 1]);
+            leveled = true;
+            arg += 2;
+        }
+        else if (encode && strcmp(argv[arg], "-t") == 0)
+        {
+            threads = strtoul(argv[arg + 1], NULL, 10);
+            arg += 2;
+        }
+        else
+            break;
+    }
 
-int main(int argc, const char **argv)
-{
-    if (argc != 2)
+    if (arg + 2 != argc || level < Lzss::MIN_LEVEL || level > Lzss::MAX_LEVEL)
     {
-        std::cout << "Expected a filename\n";
+        print_usage();
         return -1;
     }
 
-    auto input = read_file(argv[1]);
-
-    Lzss lzss(10, 6, 2);
+    try
+    {
+        FILE *input = open_file(argv[arg], false);
+        FILE *output = NULL;
 
-    auto compressed = lzss.encode(input);
+        try
+        {
+            output = open_file(argv[arg + 1], true);
 
-    auto uncompressed = lzss.decode(compressed);
+            if (raw)
+            {
+                lzss_dispatch(10, 6, 2, leveled ? Lzss::get_level(level) : Lzss::get_reference_level(), [&](auto &lzss)
+                {
+                    convert_raw(lzss, encode, input, output);
+                    return 0;
+                });
+            }
+            else if (encode)
+            {
+                ThreadPool pool(threads);
 
-    for (uint32_t i = 0; i < input.length; i++)
-    {
-        if (input[i] != uncompressed[i])
+                lzss_dispatch(10, 6, 2, level, [&](auto &lzss)
+                {
+                    compress(lzss, input, output, pool);
+                    return 0;
+                });
+            }
+            else
+                decompress(input, output);
+        }
+        catch (...)
         {
-            std::cout << "Byte mismatch at byte " << i << "\n";
-            return -1;
+            close_file(input);
+            if (output != NULL)
+                close_file(output);
+            throw;
         }
+
+        close_file(input);
+        close_file(output);
+    }
+    catch (const std::exception &error)
+    {
+        std::cerr << "Error: " << error.what() << "\n";
+        return -1;
     }
 
     return 0;
@@ -0,0 +1,4999 @@
+#ifndef LZSS_CPP_HPP
+#define LZSS_CPP_HPP
+
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// Source of the memory behind every Array. The codec never frees anything itself, so a caller can route
+// all owned buffers through one allocator to reuse them, cap them or account for them.
+class Allocator
+{
+public:
+    virtual ~Allocator() {}
+
+    virtual void *allocate(std::size_t size) = 0;
+    virtual void deallocate(void *pointer, std::size_t size) = 0;
+};
+
+class HeapAllocator : public Allocator
+{
+public:
+    void *allocate(std::size_t size) override
+    {
+        return ::operator new(size);
+    }
+
+    void deallocate(void *pointer, std::size_t) override
+    {
+        ::operator delete(pointer);
+    }
+
+    static HeapAllocator *instance()
+    {
+        static HeapAllocator heap;
+        return &heap;
+    }
+};
+
+// Keeps released buffers around, binned by power-of-two size, and hands them out again. After warming up
+// a worker that encodes and decodes similar messages over and over does no heap allocation at all.
+// Thread-safe, so one pool can be shared between the threads of a ThreadPool or a server.
+class BufferPool : public Allocator
+{
+private:
+    static constexpr uint32_t MIN_SIZE_BITS = 6;
+    static constexpr uint32_t SIZE_CLASSES = 64;
+
+    std::mutex mutex;
+    std::vector<void *> free_buffers[SIZE_CLASSES];
+
+    Allocator *upstream;
+    uint32_t max_cached;
+
+    static uint32_t size_class(std::size_t size)
+    {
+        uint32_t bits = MIN_SIZE_BITS;
+        while (bits < SIZE_CLASSES - 1 && ((std::size_t)1 << bits) < size)
+            bits += 1;
+
+        return bits;
+    }
+
+public:
+    // Keeps up to `max_cached` free buffers per size class, anything beyond that goes back to `upstream`.
+    BufferPool(uint32_t max_cached = 64, Allocator *upstream = HeapAllocator::instance()) : upstream(upstream), max_cached(max_cached) {}
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    ~BufferPool()
+    {
+        this->release();
+    }
+
+    void *allocate(std::size_t size) override
+    {
+        uint32_t bits = size_class(size);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            if (!this->free_buffers[bits].empty())
+            {
+                void *pointer = this->free_buffers[bits].back();
+                this->free_buffers[bits].pop_back();
+                return pointer;
+            }
+        }
+
+        return this->upstream->allocate((std::size_t)1 << bits);
+    }
+
+    void deallocate(void *pointer, std::size_t size) override
+    {
+        uint32_t bits = size_class(size);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            if (this->free_buffers[bits].size() < this->max_cached)
+            {
+                this->free_buffers[bits].push_back(pointer);
+                return;
+            }
+        }
+
+        this->upstream->deallocate(pointer, (std::size_t)1 << bits);
+    }
+
+    // Returns every cached buffer to the upstream allocator.
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        for (uint32_t bits = 0; bits < SIZE_CLASSES; bits += 1)
+        {
+            for (void *pointer : this->free_buffers[bits])
+                this->upstream->deallocate(pointer, (std::size_t)1 << bits);
+
+            this->free_buffers[bits].clear();
+        }
+    }
+};
+
+// Owning buffer of `length` elements. Move-only: the memory goes back to its allocator exactly once,
+// when the last owner is destroyed. `length` may be lowered after the fact to trim unused space.
+template <typename T>
+class Array
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Array holds raw, uninitialized memory");
+
+private:
+    T *buffer;
+    uint32_t capacity;
+    Allocator *allocator;
+
+    void release()
+    {
+        if (this->buffer != NULL)
+            this->allocator->deallocate(this->buffer, (std::size_t)this->capacity * sizeof(T));
+
+        this->buffer = NULL;
+        this->capacity = 0;
+        this->length = 0;
+    }
+
+public:
+    Array(uint32_t length, Allocator *allocator = NULL)
+    {
+        this->allocator = (allocator == NULL) ? HeapAllocator::instance() : allocator;
+        this->buffer = (T *)this->allocator->allocate((std::size_t)length * sizeof(T));
+        this->capacity = length;
+        this->length = length;
+    }
+
+    Array(const Array &) = delete;
+    Array &operator=(const Array &) = delete;
+
+    Array(Array &&other) : buffer(other.buffer), capacity(other.capacity), allocator(other.allocator), length(other.length)
+    {
+        other.buffer = NULL;
+        other.capacity = 0;
+        other.length = 0;
+    }
+
+    Array &operator=(Array &&other)
+    {
+        if (this != &other)
+        {
+            this->release();
+
+            this->buffer = other.buffer;
+            this->capacity = other.capacity;
+            this->allocator = other.allocator;
+            this->length = other.length;
+
+            other.buffer = NULL;
+            other.capacity = 0;
+            other.length = 0;
+        }
+
+        return *this;
+    }
+
+    ~Array()
+    {
+        this->release();
+    }
+
+    uint32_t length;
+
+    T &operator[](std::size_t idx) { return this->buffer[idx]; }
+    const T &operator[](std::size_t idx) const { return this->buffer[idx]; }
+
+    T *get_buffer()
+    {
+        return this->buffer;
+    }
+
+    const T *get_buffer() const
+    {
+        return this->buffer;
+    }
+};
+
+// Non-owning view of `length` elements somewhere in memory: an Array, part of one, or any other buffer.
+template <typename T>
+class Span
+{
+public:
+    T *data;
+    std::size_t length;
+
+    Span() : data(NULL), length(0) {}
+    Span(T *data, std::size_t length) : data(data), length(length) {}
+    Span(Array<typename std::remove_const<T>::type> &array) : data(array.get_buffer()), length(array.length) {}
+    Span(const Array<typename std::remove_const<T>::type> &array) : data(array.get_buffer()), length(array.length) {}
+
+    T &operator[](std::size_t idx) const { return this->data[idx]; }
+
+    Span subspan(std::size_t offset, std::size_t count) const
+    {
+        return Span(this->data + offset, count);
+    }
+};
+
+static inline uint64_t _byte_swap(uint64_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _byteswap_uint64(value);
+#else
+    return __builtin_bswap64(value);
+#endif
+}
+
+static inline uint64_t _load_uint64_be(const uint8_t *bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return value;
+#else
+    return _byte_swap(value);
+#endif
+}
+
+static inline void _store_uint64_be(uint8_t *bytes, uint64_t value)
+{
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    value = _byte_swap(value);
+#endif
+
+    memcpy(bytes, &value, sizeof(value));
+}
+
+static inline void _store_uint32_le(uint8_t *bytes, uint32_t value)
+{
+    for (uint32_t i = 0; i < 4; i += 1)
+        bytes[i] = value >> (i * 8);
+}
+
+static inline void _store_uint64_le(uint8_t *bytes, uint64_t value)
+{
+    for (uint32_t i = 0; i < 8; i += 1)
+        bytes[i] = value >> (i * 8);
+}
+
+static inline uint32_t _load_uint32_le(const uint8_t *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static inline uint64_t _load_uint64_le(const uint8_t *bytes)
+{
+    return _load_uint32_le(bytes) | ((uint64_t)_load_uint32_le(bytes + 4) << 32);
+}
+
+// Byte-aligned 7-bit VLQ, least significant group first. Unlike a raw stream's length header, 0 still takes a byte.
+// Returns how many bytes were written, at most 5.
+static inline uint32_t _store_7bit_uint32(uint8_t *bytes, uint32_t value)
+{
+    uint32_t count = 0;
+
+    for (; value > 127; value >>= 7)
+        bytes[count++] = 128 | (value & 127);
+
+    bytes[count++] = value;
+    return count;
+}
+
+// Reads one from `input` at `position` and moves `position` past it. Throws std::out_of_range on a truncated one.
+static inline uint32_t _load_7bit_uint32(Span<const uint8_t> input, uint64_t &position)
+{
+    uint32_t value = 0;
+
+    for (uint32_t shift = 0; shift < 35; shift += 7)
+    {
+        if (position >= input.length)
+            throw std::out_of_range("input");
+
+        uint8_t byte = input[position++];
+        value |= (uint32_t)(byte & 127) << shift;
+
+        if ((byte & 128) == 0)
+            return value;
+    }
+
+    throw std::out_of_range("input");
+}
+
+// Bit stream with a 64-bit bit buffer. Writes shift a whole field into the buffer at once and
+// spill it 8 bytes at a time; reads take a field straight out of a big-endian 64-bit load at the
+// current bit position. The layout is the MSB-first one of the other ports, bit for bit.
+class BitStream64
+{
+private:
+    Span<uint8_t> buffer;
+
+    uint32_t buffer_length;
+
+    // Pending output bits, right-aligned.
+    uint64_t bit_buffer;
+    uint8_t bit_count;
+
+    // Read cursor, in bits from the start of the buffer.
+    uint64_t bit_position;
+
+public:
+    BitStream64(Span<uint8_t> buffer) : buffer(buffer)
+    {
+        this->buffer_length = buffer.length;
+        this->buffer_position = 0;
+        this->bit_buffer = 0;
+        this->bit_count = 0;
+        this->bit_position = 0;
+    }
+
+    // Read-only stream over constant bytes. Nothing may be written through it.
+    BitStream64(Span<const uint8_t> buffer) : BitStream64(Span<uint8_t>(const_cast<uint8_t *>(buffer.data), buffer.length)) {}
+
+    BitStream64(Array<uint8_t> &buffer) : BitStream64(Span<uint8_t>(buffer)) {}
+
+    // Bytes written so far. Only counts spilled bytes until `flush` is called.
+    uint32_t buffer_position;
+
+    void flush()
+    {
+        if (this->bit_count == 0)
+            return;
+
+        uint32_t bytes = (this->bit_count + 7) / 8;
+        uint64_t aligned = this->bit_buffer << (64 - this->bit_count);
+
+        if (this->buffer_position + bytes > this->buffer_length)
+            throw std::out_of_range("buffer");
+
+        for (uint32_t i = 0; i < bytes; i += 1)
+            this->buffer[this->buffer_position++] = aligned >> (56 - i * 8);
+
+        this->bit_buffer = 0;
+        this->bit_count = 0;
+    }
+
+    // Returns the next 64 bits from the read cursor, MSB first. At least 57 of them are valid,
+    // bits past the end of the buffer read as zero.
+    uint64_t peek() const
+    {
+        uint32_t byte_position = this->bit_position >> 3;
+        uint64_t window = 0;
+
+        if (byte_position + 8 <= this->buffer_length)
+            window = _load_uint64_be(&this->buffer[byte_position]);
+        else
+            for (uint32_t i = 0; byte_position + i < this->buffer_length; i += 1)
+                window |= (uint64_t)this->buffer[byte_position + i] << (56 - i * 8);
+
+        return window << (this->bit_position & 7);
+    }
+
+    // True while `peek_fast` can load a whole word without running past the buffer.
+    bool can_peek_fast() const
+    {
+        return (this->bit_position >> 3) + 8 <= this->buffer_length;
+    }
+
+    // Same as `peek`, without the end-of-buffer handling. Only valid while `can_peek_fast` holds.
+    uint64_t peek_fast() const
+    {
+        return _load_uint64_be(&this->buffer[this->bit_position >> 3]) << (this->bit_position & 7);
+    }
+
+    void skip(uint8_t bits)
+    {
+        this->bit_position += bits;
+    }
+
+    // Bytes consumed by reads so far, counting a partially read byte.
+    uint32_t read_position() const
+    {
+        return (this->bit_position + 7) >> 3;
+    }
+
+    bool read_bit()
+    {
+        return this->read_uint32(1) != 0;
+    }
+
+    void write_bit(bool bit)
+    {
+        this->write_uint32(bit ? 1 : 0, 1);
+    }
+
+    uint32_t read_uint32(uint8_t bits)
+    {
+        if (this->bit_position + bits > (uint64_t)this->buffer_length * 8)
+            throw std::out_of_range("buffer");
+
+        if (bits == 0)
+            return 0;
+
+        uint32_t number = this->peek() >> (64 - bits);
+        this->bit_position += bits;
+
+        return number;
+    }
+
+    void write_uint32(uint32_t number, uint8_t bits)
+    {
+        uint64_t value = number & ((1ull << bits) - 1);
+        uint32_t free = 64 - this->bit_count;
+
+        if (bits < free)
+        {
+            this->bit_buffer = (this->bit_buffer << bits) | value;
+            this->bit_count += bits;
+            return;
+        }
+
+        // The field fills the buffer: its top `free` bits complete the word, the rest start the next one.
+        uint32_t rest = bits - free;
+
+        if (this->buffer_position + 8 > this->buffer_length)
+            throw std::out_of_range("buffer");
+
+        _store_uint64_be(&this->buffer[this->buffer_position], (this->bit_buffer << free) | (value >> rest));
+        this->buffer_position += 8;
+
+        this->bit_buffer = value & ((1ull << rest) - 1);
+        this->bit_count = rest;
+    }
+
+    // Reads an uint32 using 7-bit VLQ approach
+    uint32_t read_7bit_uint32()
+    {
+        uint32_t number = 0;
+        uint32_t shift = 0;
+        while (true)
+        {
+            uint8_t byte = this->read_uint32(8);
+            number |= (uint32_t)(byte & 127) << shift;
+            shift += 7;
+
+            if ((byte & 128) == 0 || shift > 32)
+                break;
+        }
+
+        return number;
+    }
+
+    // Writes an uint32 using 7-bit VLQ approach
+    void write_7bit_uint32(uint32_t number)
+    {
+        while (number > 127)
+        {
+            uint32_t b = 128 | (number & 127); // Set the first bit as 1
+            this->write_uint32(b, 8);
+            number >>= 7;
+        }
+
+        if (number > 0)
+            this->write_uint32(number & 127, 8);
+    }
+};
+
+typedef struct match_t
+{
+    uint32_t offset;
+    uint32_t length;
+} match_t;
+
+// How a token sits at the top of a 64-bit peek: the flag bit, then one or two fixed-width fields.
+// Literals use the first field for the byte; pairs use it for the offset and the second for the length.
+typedef struct token_layout_t
+{
+    uint8_t bits;
+    uint8_t first_shift;
+    uint8_t second_shift;
+    uint32_t first_mask;
+    uint32_t second_mask;
+} token_layout_t;
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+static inline match_t _create_match(uint32_t offset, uint32_t length)
+{
+    match_t match = {0};
+
+    match.offset = offset;
+    match.length = length;
+
+    return match;
+}
+
+// Match length kernels: each returns how many leading bytes of `a` and `b` are equal, up to `limit`.
+// They never read at or past `limit`, so they are safe right up to the end of the input.
+typedef uint32_t (*match_length_fn)(const uint8_t *a, const uint8_t *b, uint32_t limit);
+
+static inline uint32_t _count_trailing_zeros(uint64_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+static inline uint64_t _load_uint64(const uint8_t *bytes)
+{
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+// Tail shared by the wide kernels: 8 bytes at a time, the first differing byte is found from the XOR of both words.
+static inline uint32_t _match_length_words(const uint8_t *a, const uint8_t *b, uint32_t length, uint32_t limit)
+{
+    while (length + 8 <= limit)
+    {
+        uint64_t difference = _load_uint64(a + length) ^ _load_uint64(b + length);
+
+        if (difference != 0)
+        {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            return length + (__builtin_clzll(difference) >> 3);
+#else
+            return length + (_count_trailing_zeros(difference) >> 3);
+#endif
+        }
+
+        length += 8;
+    }
+
+    while (length < limit && a[length] == b[length])
+        length += 1;
+
+    return length;
+}
+
+[[maybe_unused]] static uint32_t match_length_word(const uint8_t *a, const uint8_t *b, uint32_t limit)
+{
+    return _match_length_words(a, b, 0, limit);
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LZSS_HAS_SSE2 1
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LZSS_TARGET_AVX2
+#else
+#define LZSS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static uint32_t match_length_sse2(const uint8_t *a, const uint8_t *b, uint32_t limit)
+{
+    uint32_t length = 0;
+
+    while (length + 16 <= limit)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + length));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + length));
+        uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+
+        if (equal != 0xFFFF)
+            return length + _count_trailing_zeros(~equal & 0xFFFF);
+
+        length += 16;
+    }
+
+    return _match_length_words(a, b, length, limit);
+}
+
+LZSS_TARGET_AVX2 static uint32_t match_length_avx2(const uint8_t *a, const uint8_t *b, uint32_t limit)
+{
+    uint32_t length = 0;
+
+    while (length + 32 <= limit)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + length));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + length));
+        uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (equal != 0xFFFFFFFF)
+            return length + _count_trailing_zeros(~equal);
+
+        length += 32;
+    }
+
+    return _match_length_words(a, b, length, limit);
+}
+
+static bool _cpu_has_avx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+    bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && (info[1] & (1 << 5));
+#else
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    // AVX2 is only usable when the OS saves the YMM registers (OSXSAVE + AVX, and XCR0 enables SSE and AVX state).
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return false;
+
+    uint32_t xcr0_low, xcr0_high;
+    __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+    if ((xcr0_low & 6) != 6)
+        return false;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & bit_AVX2) != 0;
+#endif
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define LZSS_HAS_NEON 1
+
+static uint32_t match_length_neon(const uint8_t *a, const uint8_t *b, uint32_t limit)
+{
+    uint32_t length = 0;
+
+    while (length + 16 <= limit)
+    {
+        uint8x16_t equal = vceqq_u8(vld1q_u8(a + length), vld1q_u8(b + length));
+
+        // Narrowing shift packs the 16 byte lanes into 4 bits each of a 64-bit mask.
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(equal), 4)), 0);
+
+        if (mask != 0xFFFFFFFFFFFFFFFFull)
+            return length + (_count_trailing_zeros(~mask) >> 2);
+
+        length += 16;
+    }
+
+    return _match_length_words(a, b, length, limit);
+}
+#endif
+
+// Picks the widest kernel this CPU supports. NEON is part of the baseline wherever it is compiled in,
+// so only x86 needs a runtime check.
+static match_length_fn _select_match_length()
+{
+#if defined(LZSS_HAS_SSE2)
+    if (_cpu_has_avx2())
+        return match_length_avx2;
+
+    return match_length_sse2;
+#elif defined(LZSS_HAS_NEON)
+    return match_length_neon;
+#else
+    return match_length_word;
+#endif
+}
+
+static const match_length_fn match_length = _select_match_length();
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), the checksum of frames written with FRAME_FLAG_CHECKSUMS.
+// `crc32c(crc, bytes, length)` continues `crc`, 0 to start; x86 since SSE4.2 and ARMv8 with the CRC extension have
+// an instruction for it, everything else goes through slicing-by-8 tables.
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *bytes, size_t length);
+
+struct _crc32c_tables_t
+{
+    uint32_t table[8][256];
+
+    // x^(2^n) modulo the polynomial, for `crc32c_combine`.
+    uint32_t powers[32];
+
+    _crc32c_tables_t()
+    {
+        for (uint32_t byte = 0; byte < 256; byte += 1)
+        {
+            uint32_t crc = byte;
+            for (uint32_t bit = 0; bit < 8; bit += 1)
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+
+            this->table[0][byte] = crc;
+        }
+
+        for (uint32_t byte = 0; byte < 256; byte += 1)
+        {
+            for (uint32_t slice = 1; slice < 8; slice += 1)
+                this->table[slice][byte] = (this->table[slice - 1][byte] >> 8) ^ this->table[0][this->table[slice - 1][byte] & 0xFF];
+        }
+
+        // x^1 is bit 30 in the reflected order.
+        this->powers[0] = 1u << 30;
+        for (uint32_t n = 1; n < 32; n += 1)
+            this->powers[n] = multiply(this->powers[n - 1], this->powers[n - 1]);
+    }
+
+    // a * b modulo the polynomial, both reflected.
+    static uint32_t multiply(uint32_t a, uint32_t b)
+    {
+        uint32_t product = 0;
+
+        for (uint32_t bit = 1u << 31; bit != 0 && a != 0; bit >>= 1)
+        {
+            if (a & bit)
+            {
+                product ^= b;
+                a ^= bit;
+            }
+
+            b = (b & 1) ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+        }
+
+        return product;
+    }
+};
+
+static const _crc32c_tables_t _crc32c_tables;
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    const uint32_t (*table)[256] = _crc32c_tables.table;
+    crc = ~crc;
+
+    for (; length >= 8; bytes += 8, length -= 8)
+    {
+        uint32_t low = crc ^ _load_uint32_le(bytes);
+        uint32_t high = _load_uint32_le(bytes + 4);
+
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    }
+
+    for (; length > 0; bytes += 1, length -= 1)
+        crc = (crc >> 8) ^ table[0][(crc ^ *bytes) & 0xFF];
+
+    return ~crc;
+}
+
+#if defined(LZSS_HAS_SSE2)
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LZSS_TARGET_SSE42
+#else
+#define LZSS_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+
+LZSS_TARGET_SSE42 static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    crc = ~crc;
+
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t wide = crc;
+    for (; length >= 8; bytes += 8, length -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (uint32_t)wide;
+#endif
+
+    for (; length >= 4; bytes += 4, length -= 4)
+    {
+        uint32_t word;
+        memcpy(&word, bytes, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+
+    for (; length > 0; bytes += 1, length -= 1)
+        crc = _mm_crc32_u8(crc, *bytes);
+
+    return ~crc;
+}
+
+static bool _cpu_has_sse42()
+{
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2);
+#endif
+}
+#elif defined(__ARM_FEATURE_CRC32)
+#define LZSS_HAS_ARM_CRC32 1
+
+static uint32_t crc32c_arm(uint32_t crc, const uint8_t *bytes, size_t length)
+{
+    crc = ~crc;
+
+    for (; length >= 8; bytes += 8, length -= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        crc = __crc32cd(crc, word);
+    }
+
+    for (; length > 0; bytes += 1, length -= 1)
+        crc = __crc32cb(crc, *bytes);
+
+    return ~crc;
+}
+#endif
+
+static crc32c_fn _select_crc32c()
+{
+#if defined(LZSS_HAS_SSE2)
+    if (_cpu_has_sse42())
+        return crc32c_sse42;
+#elif defined(LZSS_HAS_ARM_CRC32)
+    return crc32c_arm;
+#endif
+
+    return crc32c_table;
+}
+
+static const crc32c_fn crc32c = _select_crc32c();
+
+// The CRC of a message from the CRCs of its two halves, `second` covering the last `second_length` bytes.
+// Lets blocks be checksummed independently, on any thread, and still give the checksum of the whole content.
+static inline uint32_t crc32c_combine(uint32_t first, uint32_t second, uint64_t second_length)
+{
+    // Appending n bytes multiplies the first CRC by x^(8n).
+    uint32_t power = 1u << 31;
+
+    for (uint32_t n = 3; second_length != 0; second_length >>= 1, n += 1)
+    {
+        if (second_length & 1)
+            power = _crc32c_tables_t::multiply(_crc32c_tables.powers[n & 31], power);
+    }
+
+    return _crc32c_tables_t::multiply(power, first) ^ second;
+}
+
+// Throws std::invalid_argument unless the `length` bytes at `bytes` have the CRC-32C `expected`.
+static inline void verify_checksum(const uint8_t *bytes, uint64_t length, uint32_t expected)
+{
+    if (crc32c(0, bytes, length) != expected)
+        throw std::invalid_argument("checksum");
+}
+
+// Encoder and decoder statistics, compiled in with -DLZSS_STATS=1 for tuning window and chain settings
+// against real data. Without it every LZSS_STAT statement disappears, and so does its cost.
+#ifndef LZSS_STATS
+#define LZSS_STATS 0
+#endif
+
+#if LZSS_STATS
+#define LZSS_STAT(statement) statement
+#else
+#define LZSS_STAT(statement)
+#endif
+
+// The counters, as X(name):
+//   literals, pairs                   tokens written by the encoder
+//   rep_pairs, rep_early_hits         pairs of those coded as a RepCache slot, and rep matches taken without a search
+//   searches, candidates              match finder lookups and the candidates they inspected
+//   bytes_compared                    bytes compared against those candidates
+//   search_ns, bitstream_ns           nanoseconds in match finder lookups and writing tokens to the BitStream
+//   literals_decoded, pairs_decoded   tokens read by `decode_tokens`
+//   decode_ns                         nanoseconds in `decode_tokens`
+#define LZSS_STATS_COUNTERS(X) \
+    X(literals)                \
+    X(pairs)                   \
+    X(rep_pairs)               \
+    X(rep_early_hits)          \
+    X(searches)                \
+    X(candidates)              \
+    X(bytes_compared)          \
+    X(search_ns)               \
+    X(bitstream_ns)            \
+    X(literals_decoded)        \
+    X(pairs_decoded)           \
+    X(decode_ns)
+
+// Pairs by floor(log2) of their length and offset: bucket `k` counts values in [2^k, 2^(k + 1)).
+#define STATS_HISTOGRAM_SIZE 32
+
+typedef struct lzss_stats_t
+{
+#define X(name) uint64_t name;
+    LZSS_STATS_COUNTERS(X)
+#undef X
+
+    uint64_t length_histogram[STATS_HISTOGRAM_SIZE];
+    uint64_t offset_histogram[STATS_HISTOGRAM_SIZE];
+} lzss_stats_t;
+
+// Process-wide counters behind `lzss_stats()`. Atomic, since the blocks of a frame are encoded on several
+// threads at once; a snapshot taken while work is still running is only roughly consistent.
+class LzssStats
+{
+public:
+#define X(name) std::atomic<uint64_t> name;
+    LZSS_STATS_COUNTERS(X)
+#undef X
+
+    std::atomic<uint64_t> length_histogram[STATS_HISTOGRAM_SIZE];
+    std::atomic<uint64_t> offset_histogram[STATS_HISTOGRAM_SIZE];
+
+    LzssStats() { this->reset(); }
+
+    static uint32_t bucket(uint32_t value)
+    {
+        uint32_t bucket = 0;
+        while (value >> (bucket + 1))
+            bucket += 1;
+
+        return bucket;
+    }
+
+    void add_pair(uint32_t length, uint32_t offset)
+    {
+        this->pairs += 1;
+        this->length_histogram[bucket(length)] += 1;
+        this->offset_histogram[bucket(offset)] += 1;
+    }
+
+    lzss_stats_t snapshot() const
+    {
+        lzss_stats_t stats;
+
+#define X(name) stats.name = this->name.load();
+        LZSS_STATS_COUNTERS(X)
+#undef X
+
+        for (uint32_t i = 0; i < STATS_HISTOGRAM_SIZE; i += 1)
+        {
+            stats.length_histogram[i] = this->length_histogram[i].load();
+            stats.offset_histogram[i] = this->offset_histogram[i].load();
+        }
+
+        return stats;
+    }
+
+    void reset()
+    {
+#define X(name) this->name = 0;
+        LZSS_STATS_COUNTERS(X)
+#undef X
+
+        for (uint32_t i = 0; i < STATS_HISTOGRAM_SIZE; i += 1)
+        {
+            this->length_histogram[i] = 0;
+            this->offset_histogram[i] = 0;
+        }
+    }
+};
+
+static inline LzssStats &lzss_stats()
+{
+    static LzssStats stats;
+    return stats;
+}
+
+// Adds the nanoseconds between its construction and destruction to `counter`.
+class StatsTimer
+{
+private:
+    std::atomic<uint64_t> &counter;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StatsTimer(std::atomic<uint64_t> &counter) : counter(counter), start(std::chrono::steady_clock::now()) {}
+
+    ~StatsTimer()
+    {
+        this->counter += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count();
+    }
+};
+
+// The snapshot as one JSON object, histograms as arrays of STATS_HISTOGRAM_SIZE counts.
+static inline std::string lzss_stats_json(const lzss_stats_t &stats)
+{
+    std::string json = "{";
+
+#define X(name) json += "\"" #name "\": " + std::to_string(stats.name) + ", ";
+    LZSS_STATS_COUNTERS(X)
+#undef X
+
+    const char *names[2] = {"length_histogram", "offset_histogram"};
+    const uint64_t *histograms[2] = {stats.length_histogram, stats.offset_histogram};
+
+    for (int i = 0; i < 2; i += 1)
+    {
+        json += std::string(i > 0 ? ", \"" : "\"") + names[i] + "\": [";
+
+        for (uint32_t bucket = 0; bucket < STATS_HISTOGRAM_SIZE; bucket += 1)
+            json += (bucket > 0 ? ", " : "") + std::to_string(histograms[i][bucket]);
+
+        json += "]";
+    }
+
+    return json + "}";
+}
+
+// Hash-head/prev-chain match finder. Every position is linked into a chain of the
+// earlier positions that share its first `hash_length` bytes, so a lookup only visits
+// candidates that can actually reach `minimum_length`, newest first.
+// Positions are stored relative to a running `base`, so `reset` starts over for a new input by moving
+// `base` past everything stored so far instead of clearing the tables: old entries then fall outside
+// every window and end a chain walk just like a too-distant candidate.
+class HashChain
+{
+private:
+    static constexpr uint32_t NIL = 0xFFFFFFFF;
+    static constexpr uint8_t HASH_BITS = 16;
+
+    std::vector<uint32_t> head;
+    std::vector<uint32_t> prev;
+
+    uint32_t window_mask;
+    uint32_t hash_length;
+
+    uint32_t base;
+    uint32_t end;
+
+    uint32_t hash(const uint8_t *bytes) const
+    {
+        if (this->hash_length == 1)
+            return bytes[0];
+
+        if (this->hash_length == 2)
+            return (bytes[0] << 8) | bytes[1];
+
+        uint32_t key = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+        return (key * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+public:
+    HashChain(uint8_t offset_bits, uint32_t minimum_length)
+    {
+        // Matches shorter than `minimum_length` are never emitted, so keying on more bytes than that would miss candidates.
+        this->hash_length = MIN(MAX(minimum_length, 1), 3);
+        this->window_mask = (1u << offset_bits) - 1;
+
+        this->head.assign(1 << (this->hash_length == 1 ? 8 : HASH_BITS), NIL);
+        this->prev.assign(this->window_mask + 1, NIL);
+
+        this->base = 0;
+        this->end = 0;
+    }
+
+    bool matches(uint8_t offset_bits, uint32_t minimum_length) const
+    {
+        return this->window_mask == (1u << offset_bits) - 1 && this->hash_length == MIN(MAX(minimum_length, 1), 3);
+    }
+
+    // Forgets every inserted position before indexing a new input of `length` bytes.
+    void reset(uint32_t length)
+    {
+        // Only clear for real once the stored positions would run into NIL.
+        if ((uint64_t)this->end + length >= NIL)
+        {
+            std::fill(this->head.begin(), this->head.end(), NIL);
+            std::fill(this->prev.begin(), this->prev.end(), NIL);
+            this->end = 0;
+        }
+
+        this->base = this->end;
+        this->end = this->base + length;
+    }
+
+    void insert(Span<const uint8_t> input, uint32_t index)
+    {
+        if (index + this->hash_length > input.length)
+            return;
+
+        uint32_t key = this->hash(&input[index]);
+        uint32_t position = this->base + index;
+
+        this->prev[position & this->window_mask] = this->head[key];
+        this->head[key] = position;
+    }
+
+    // Walks at most `chain_depth` candidates no further than `max_offset` back and returns the longest one,
+    // preferring the closest on ties. Lengths are capped at `maximum_length` and the end of the input.
+    match_t find(Span<const uint8_t> input, uint32_t index, uint32_t max_offset, uint32_t maximum_length, uint32_t chain_depth) const
+    {
+        uint32_t best_offset = 0, best_length = 0;
+
+        if (index + this->hash_length > input.length)
+            return _create_match(0, 0);
+
+        uint32_t limit = MIN(maximum_length, input.length - index);
+        uint32_t position = this->base + index;
+        uint32_t lowest = this->base + ((max_offset > index) ? 0 : index - max_offset);
+        uint32_t candidate = this->head[this->hash(&input[index])];
+
+        LZSS_STAT(uint64_t candidates = 0; uint64_t compared = 0;)
+
+        for (uint32_t depth = 0; depth < chain_depth && candidate != NIL && candidate >= lowest; depth += 1)
+        {
+            const uint8_t *bytes = &input[candidate - this->base];
+            LZSS_STAT(candidates += 1; compared += 1;)
+
+            // Checking the byte that would extend the current best first rejects most candidates without a full compare.
+            if (bytes[best_length] == input[index + best_length])
+            {
+                uint32_t length = match_length(bytes, &input[index], limit);
+                LZSS_STAT(compared += MIN(length + 1, limit);)
+
+                if (length > best_length)
+                {
+                    best_length = length;
+                    best_offset = position - candidate;
+
+                    if (length == limit)
+                        break;
+                }
+            }
+
+            candidate = this->prev[candidate & this->window_mask];
+        }
+
+        LZSS_STAT(lzss_stats().candidates += candidates; lzss_stats().bytes_compared += compared;)
+
+        return _create_match(best_offset, best_length);
+    }
+};
+
+// Binary-tree match finder for large windows, in the style of LZMA's BT4. Positions sharing a hash
+// bucket form a binary search tree ordered by the bytes that follow them, so a lookup descends towards
+// the suffixes closest to the current one instead of walking every candidate in the window. The same
+// descent re-roots the tree at the current position, which is why `find` also inserts it.
+// Positions use the same running base as HashChain, so `reset` is just as cheap.
+class BinaryTree
+{
+private:
+    static constexpr uint32_t NIL = 0xFFFFFFFF;
+    static constexpr uint8_t HASH_BITS = 16;
+
+    std::vector<uint32_t> head;
+
+    // Left and right child of every position in the window, as `tree[2 * slot]` and `tree[2 * slot + 1]`.
+    std::vector<uint32_t> tree;
+
+    uint32_t window_mask;
+    uint32_t hash_length;
+    uint32_t maximum_length;
+    uint32_t depth;
+
+    uint32_t base;
+    uint32_t end;
+    uint32_t next;
+
+    uint32_t hash(const uint8_t *bytes) const
+    {
+        if (this->hash_length == 1)
+            return bytes[0];
+
+        if (this->hash_length == 2)
+            return (bytes[0] << 8) | bytes[1];
+
+        uint32_t key = (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+        return (key * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    // Links `index` in as the new root of its bucket and returns the longest match met on the way down.
+    match_t update(Span<const uint8_t> input, uint32_t index, uint32_t max_offset, uint32_t maximum_length, uint32_t depth)
+    {
+        uint32_t position = this->base + index;
+        uint32_t limit = MIN(maximum_length, input.length - index);
+        uint32_t lowest = this->base + ((max_offset > index) ? 0 : index - max_offset);
+        uint32_t key = this->hash(&input[index]);
+        uint32_t candidate = this->head[key];
+
+        uint32_t best_offset = 0, best_length = 0;
+        const uint8_t *current = &input[index];
+
+        // Everything smaller than the current suffix goes left of it, everything larger right. `*smaller`
+        // and `*larger` are the links still waiting for a node, `smaller_length` and `larger_length` how many
+        // bytes the nodes on either side are already known to share, so comparisons can start past them.
+        uint32_t *smaller = &this->tree[2 * (position & this->window_mask)];
+        uint32_t *larger = smaller + 1;
+        uint32_t smaller_length = 0, larger_length = 0;
+
+        this->head[key] = position;
+        this->next = position + 1;
+
+        LZSS_STAT(uint64_t candidates = 0; uint64_t compared = 0;)
+
+        for (uint32_t visited = 0;; visited += 1)
+        {
+            if (candidate == NIL || candidate < lowest || visited == depth)
+            {
+                *smaller = NIL;
+                *larger = NIL;
+                break;
+            }
+
+            const uint8_t *bytes = &input[candidate - this->base];
+            uint32_t *children = &this->tree[2 * (candidate & this->window_mask)];
+            uint32_t length = MIN(smaller_length, larger_length);
+
+            if (length < limit && bytes[length] == current[length])
+                length += match_length(bytes + length, current + length, limit - length);
+
+            LZSS_STAT(candidates += 1; compared += MIN(length + 1, limit) - MIN(smaller_length, larger_length);)
+
+            if (length > best_length)
+            {
+                best_length = length;
+                best_offset = position - candidate;
+            }
+
+            // Equal up to the limit: the candidate takes the current position's place, children and all.
+            if (length == limit)
+            {
+                *smaller = children[0];
+                *larger = children[1];
+                break;
+            }
+
+            if (bytes[length] < current[length])
+            {
+                *smaller = candidate;
+                smaller = &children[1];
+                candidate = *smaller;
+                smaller_length = length;
+            }
+            else
+            {
+                *larger = candidate;
+                larger = &children[0];
+                candidate = *larger;
+                larger_length = length;
+            }
+        }
+
+        LZSS_STAT(lzss_stats().candidates += candidates; lzss_stats().bytes_compared += compared;)
+
+        return _create_match(best_offset, best_length);
+    }
+
+public:
+    // `maximum_length` and `depth` (the most tree nodes visited per position) are the same ones later passed
+    // to `find`; `insert` needs them too, since inserting walks the tree exactly like a lookup.
+    BinaryTree(uint8_t offset_bits, uint32_t minimum_length, uint32_t maximum_length, uint32_t depth)
+    {
+        this->hash_length = MIN(MAX(minimum_length, 1), 3);
+        this->window_mask = (1u << offset_bits) - 1;
+        this->maximum_length = maximum_length;
+        this->depth = depth;
+
+        this->head.assign(1 << (this->hash_length == 1 ? 8 : HASH_BITS), NIL);
+        this->tree.assign(2 * ((size_t)this->window_mask + 1), NIL);
+
+        this->base = 0;
+        this->end = 0;
+        this->next = 0;
+    }
+
+    bool matches(uint8_t offset_bits, uint32_t minimum_length, uint32_t maximum_length, uint32_t depth) const
+    {
+        return this->window_mask == (1u << offset_bits) - 1 && this->hash_length == MIN(MAX(minimum_length, 1), 3) &&
+               this->maximum_length == maximum_length && this->depth == depth;
+    }
+
+    void reset(uint32_t length)
+    {
+        if ((uint64_t)this->end + length >= NIL)
+        {
+            std::fill(this->head.begin(), this->head.end(), NIL);
+            this->end = 0;
+        }
+
+        this->base = this->end;
+        this->end = this->base + length;
+        this->next = this->base;
+    }
+
+    // A no-op for positions `find` already linked in.
+    void insert(Span<const uint8_t> input, uint32_t index)
+    {
+        if (this->base + index < this->next || index + this->hash_length > input.length)
+            return;
+
+        this->update(input, index, this->window_mask, this->maximum_length, this->depth);
+    }
+
+    match_t find(Span<const uint8_t> input, uint32_t index, uint32_t max_offset, uint32_t maximum_length, uint32_t depth)
+    {
+        if (index + this->hash_length > input.length)
+            return _create_match(0, 0);
+
+        return this->update(input, index, max_offset, maximum_length, depth);
+    }
+};
+
+// `decode` allocates this many bytes past the end of its output so `_copy_match` can always finish with a whole store.
+#define MATCH_COPY_SLACK 16
+
+// Copies a `length` byte match from `offset` bytes back with the same result as a byte-by-byte forward copy,
+// but in 16 or 8 byte stores. Offsets under 8 overlap their own output, so the first 8 bytes are expanded byte
+// by byte and that word, which repeats the pattern, is stored again every largest multiple of `offset` that
+// fits in 8. Can write up to MATCH_COPY_SLACK - 1 bytes past the end of the match.
+static inline void _copy_match(uint8_t *destination, uint32_t offset, uint32_t length)
+{
+    static const uint8_t pattern_steps[8] = {8, 8, 8, 6, 8, 5, 6, 7};
+
+    const uint8_t *source = destination - offset;
+    uint8_t *end = destination + length;
+
+    if (offset >= 16)
+    {
+        do
+        {
+            memcpy(destination, source, 16);
+            destination += 16;
+            source += 16;
+        } while (destination < end);
+    }
+    else if (offset >= 8)
+    {
+        do
+        {
+            memcpy(destination, source, 8);
+            destination += 8;
+            source += 8;
+        } while (destination < end);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < 8; i += 1)
+            destination[i] = source[i];
+
+        uint64_t pattern = _load_uint64(destination);
+        uint32_t step = pattern_steps[offset];
+
+        for (destination += step; destination < end; destination += step)
+            memcpy(destination, &pattern, 8);
+    }
+}
+
+// `_copy_match` for a match with only `room` writable bytes from `destination` on, `length` at most `room`.
+// The wide copy goes as far as it can without writing past them, the rest is copied byte by byte.
+static inline void _copy_match_within(uint8_t *destination, uint32_t offset, uint64_t length, uint64_t room)
+{
+    uint64_t wide = (room >= length + MATCH_COPY_SLACK) ? length : MIN(length, room - MIN(room, (uint64_t)MATCH_COPY_SLACK));
+
+    if (wide > 0)
+        _copy_match(destination, offset, wide);
+
+    // Pointer arithmetic, since the match may start in history before `destination`.
+    for (uint64_t i = wide; i < length; i += 1)
+        destination[i] = destination[i - (int64_t)offset];
+}
+
+// Fixed set of worker threads that run `parallel_for` jobs. The calling thread takes part in every job,
+// so a pool of N workers keeps N + 1 threads busy.
+//
+// Items are scheduled by work stealing: every participant starts with an equal contiguous range and pops
+// items off its front; once it runs dry it steals the back half of another participant's range. Each
+// range is a [begin, end) pair packed in one atomic word, so owner pops and steals are one CAS each.
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::unique_ptr<std::atomic<uint64_t>[]> ranges;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    // Current job, guarded by `mutex` and published by bumping `generation`.
+    std::function<void(uint32_t)> body;
+    uint32_t busy_workers;
+    uint64_t generation;
+    bool stopping;
+
+    std::exception_ptr error;
+
+    static uint64_t pack(uint32_t begin, uint32_t end)
+    {
+        return ((uint64_t)begin << 32) | end;
+    }
+
+    bool pop(uint32_t participant, uint32_t &item)
+    {
+        std::atomic<uint64_t> &range = this->ranges[participant];
+        uint64_t current = range.load();
+
+        while (true)
+        {
+            uint32_t begin = current >> 32, end = (uint32_t)current;
+            if (begin >= end)
+                return false;
+
+            if (range.compare_exchange_weak(current, pack(begin + 1, end)))
+            {
+                item = begin;
+                return true;
+            }
+        }
+    }
+
+    bool steal(uint32_t participant, uint32_t &item)
+    {
+        uint32_t participants = this->size();
+
+        for (uint32_t i = 1; i < participants; i += 1)
+        {
+            std::atomic<uint64_t> &victim = this->ranges[(participant + i) % participants];
+            uint64_t current = victim.load();
+
+            while (true)
+            {
+                uint32_t begin = current >> 32, end = (uint32_t)current;
+                if (begin >= end)
+                    break;
+
+                uint32_t middle = begin + (end - begin) / 2;
+                if (victim.compare_exchange_weak(current, pack(begin, middle)))
+                {
+                    // Only the owner refills an empty range, so a plain store can't lose a concurrent steal.
+                    this->ranges[participant].store(pack(middle + 1, end));
+                    item = middle;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void run_items(uint32_t participant)
+    {
+        uint32_t item;
+
+        while (this->pop(participant, item) || this->steal(participant, item))
+        {
+            try
+            {
+                this->body(item);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->error)
+                    this->error = std::current_exception();
+            }
+        }
+    }
+
+    void work(uint32_t participant)
+    {
+        uint64_t seen = 0;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wake.wait(lock, [&] { return this->stopping || this->generation != seen; });
+
+                if (this->stopping)
+                    return;
+
+                seen = this->generation;
+            }
+
+            this->run_items(participant);
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->busy_workers == 0)
+                this->done.notify_one();
+        }
+    }
+
+public:
+    // `threads` is the total including the caller, 0 for one per hardware thread.
+    ThreadPool(uint32_t threads = 0) : busy_workers(0), generation(0), stopping(false)
+    {
+        if (threads == 0)
+            threads = MAX(std::thread::hardware_concurrency(), 1);
+
+        this->ranges.reset(new std::atomic<uint64_t>[threads]);
+        for (uint32_t i = 0; i < threads; i += 1)
+            this->ranges[i] = 0;
+
+        // Participant 0 is the thread calling `parallel_for`.
+        for (uint32_t i = 1; i < threads; i += 1)
+            this->workers.emplace_back(&ThreadPool::work, this, i);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+
+        this->wake.notify_all();
+
+        for (auto &worker : this->workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    uint32_t size() const
+    {
+        return this->workers.size() + 1;
+    }
+
+    // Calls `body(item)` once for every item in [0, count) across the pool and returns when all are done.
+    // Rethrows the first exception any call threw. Not reentrant: one job at a time per pool.
+    void parallel_for(uint32_t count, const std::function<void(uint32_t)> &body)
+    {
+        if (count == 0)
+            return;
+
+        if (this->workers.empty() || count == 1)
+        {
+            for (uint32_t item = 0; item < count; item += 1)
+                body(item);
+            return;
+        }
+
+        uint32_t participants = this->size();
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            for (uint32_t i = 0; i < participants; i += 1)
+                this->ranges[i] = pack((uint64_t)count * i / participants, (uint64_t)count * (i + 1) / participants);
+
+            this->body = body;
+            this->busy_workers = this->workers.size();
+            this->error = NULL;
+            this->generation += 1;
+        }
+
+        this->wake.notify_all();
+        this->run_items(0);
+
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->done.wait(lock, [&] { return this->busy_workers == 0; });
+
+        if (this->error)
+            std::rethrow_exception(this->error);
+    }
+};
+
+static inline uint32_t _floor_log2(uint32_t value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return index;
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+
+// Entropy stage values (literal runs, match lengths, offsets) are coded as a bucket symbol plus raw extra
+// bits. Values under 16 get a bucket each; larger ones share a bucket per half power of two, keyed on their
+// top two bits, so any 32-bit value fits one of ENTROPY_BUCKETS buckets.
+#define ENTROPY_BUCKETS 72
+
+static inline uint32_t _value_bucket(uint32_t value)
+{
+    if (value < 16)
+        return value;
+
+    uint32_t top = _floor_log2(value);
+    return 16 + (top - 4) * 2 + ((value >> (top - 1)) & 1);
+}
+
+static inline uint32_t _bucket_extra_bits(uint32_t bucket)
+{
+    return bucket < 16 ? 0 : 4 + (bucket - 16) / 2 - 1;
+}
+
+static inline uint32_t _bucket_base(uint32_t bucket)
+{
+    if (bucket < 16)
+        return bucket;
+
+    uint32_t top = 4 + (bucket - 16) / 2;
+    return (1u << top) | ((bucket & 1) << (top - 1));
+}
+
+#define HUFFMAN_MAX_BITS 12
+#define HUFFMAN_MAX_SYMBOLS 256
+
+// Canonical Huffman code over up to 256 symbols, lengths limited to HUFFMAN_MAX_BITS so a single table
+// lookup of the next HUFFMAN_MAX_BITS bits decodes any symbol. Only the code lengths are stored, four bits
+// per symbol; codes are assigned in (length, symbol) order on both sides.
+class Huffman
+{
+private:
+    uint32_t symbol_count;
+
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+
+    // `symbol << 4 | length` for every HUFFMAN_MAX_BITS-bit prefix.
+    std::vector<uint16_t> table;
+
+    void assign_codes()
+    {
+        uint32_t counts[HUFFMAN_MAX_BITS + 1] = {0};
+        uint32_t next_code[HUFFMAN_MAX_BITS + 1] = {0};
+
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 1)
+            counts[this->lengths[symbol]] += 1;
+
+        counts[0] = 0;
+        for (uint32_t bits = 1, code = 0; bits <= HUFFMAN_MAX_BITS; bits += 1)
+        {
+            code = (code + counts[bits - 1]) << 1;
+            next_code[bits] = code;
+        }
+
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 1)
+        {
+            if (this->lengths[symbol] > 0)
+                this->codes[symbol] = next_code[this->lengths[symbol]]++;
+        }
+    }
+
+public:
+    Huffman(uint32_t symbol_count) : symbol_count(symbol_count)
+    {
+        memset(this->lengths, 0, sizeof(this->lengths));
+        memset(this->codes, 0, sizeof(this->codes));
+    }
+
+    // Builds a length-limited code for `frequencies`. Symbols with frequency 0 get no code.
+    void build(const uint32_t *frequencies)
+    {
+        std::vector<uint32_t> used;
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 1)
+        {
+            this->lengths[symbol] = 0;
+
+            if (frequencies[symbol] > 0)
+                used.push_back(symbol);
+        }
+
+        if (used.size() == 1)
+            this->lengths[used[0]] = 1;
+
+        if (used.size() <= 1)
+        {
+            this->assign_codes();
+            return;
+        }
+
+        // Plain Huffman tree over the used symbols: leaves first, then one internal node per merge.
+        std::vector<uint64_t> weights;
+        std::vector<uint32_t> parents(2 * used.size(), 0);
+        std::vector<uint32_t> heap;
+
+        for (uint32_t symbol : used)
+            weights.push_back(frequencies[symbol]);
+
+        auto heavier = [&](uint32_t a, uint32_t b) { return weights[a] != weights[b] ? weights[a] > weights[b] : a > b; };
+
+        for (uint32_t node = 0; node < used.size(); node += 1)
+            heap.push_back(node);
+        std::make_heap(heap.begin(), heap.end(), heavier);
+
+        while (heap.size() > 1)
+        {
+            uint32_t nodes[2];
+
+            for (uint32_t &node : nodes)
+            {
+                std::pop_heap(heap.begin(), heap.end(), heavier);
+                node = heap.back();
+                heap.pop_back();
+            }
+
+            parents[nodes[0]] = parents[nodes[1]] = weights.size();
+            weights.push_back(weights[nodes[0]] + weights[nodes[1]]);
+
+            heap.push_back(weights.size() - 1);
+            std::push_heap(heap.begin(), heap.end(), heavier);
+        }
+
+        // Depth of every leaf, counted per length. Parents always come after their children.
+        uint32_t root = weights.size() - 1;
+        std::vector<uint32_t> depths(weights.size(), 0);
+        std::vector<uint32_t> counts(used.size() + 1, 0);
+
+        for (uint32_t node = root; node-- > 0;)
+            depths[node] = depths[parents[node]] + 1;
+
+        for (uint32_t leaf = 0; leaf < used.size(); leaf += 1)
+            counts[depths[leaf]] += 1;
+
+        // Moves leaves up from below the limit while keeping the code complete (JPEG, Annex K.3).
+        for (uint32_t bits = used.size(); bits > HUFFMAN_MAX_BITS; bits -= 1)
+        {
+            while (counts[bits] > 0)
+            {
+                uint32_t shorter = bits - 2;
+                while (counts[shorter] == 0)
+                    shorter -= 1;
+
+                counts[bits] -= 2;
+                counts[bits - 1] += 1;
+                counts[shorter + 1] += 2;
+                counts[shorter] -= 1;
+            }
+        }
+
+        // The most frequent symbols take the shortest lengths.
+        std::stable_sort(used.begin(), used.end(), [&](uint32_t a, uint32_t b) { return frequencies[a] > frequencies[b]; });
+
+        for (uint32_t bits = 1, next = 0; bits <= MIN((uint32_t)used.size(), (uint32_t)HUFFMAN_MAX_BITS); bits += 1)
+        {
+            for (uint32_t i = 0; i < counts[bits]; i += 1)
+                this->lengths[used[next++]] = bits;
+        }
+
+        this->assign_codes();
+    }
+
+    // Code lengths, two symbols per byte.
+    uint32_t get_table_size() const { return (this->symbol_count + 1) / 2; }
+
+    void write_table(uint8_t *bytes) const
+    {
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 2)
+            bytes[symbol / 2] = (this->lengths[symbol] << 4) | (symbol + 1 < this->symbol_count ? this->lengths[symbol + 1] : 0);
+    }
+
+    // Reads code lengths written by `write_table` and builds the decoding table.
+    void read_table(const uint8_t *bytes)
+    {
+        uint32_t kraft = 0;
+
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 1)
+        {
+            this->lengths[symbol] = (symbol & 1) ? bytes[symbol / 2] & 15 : bytes[symbol / 2] >> 4;
+
+            if (this->lengths[symbol] > HUFFMAN_MAX_BITS)
+                throw std::invalid_argument("huffman");
+
+            if (this->lengths[symbol] > 0)
+                kraft += 1 << (HUFFMAN_MAX_BITS - this->lengths[symbol]);
+        }
+
+        if (kraft > (1 << HUFFMAN_MAX_BITS))
+            throw std::invalid_argument("huffman");
+
+        this->assign_codes();
+
+        // Prefixes no code starts with only show up in corrupt input. They decode as a full-length symbol 0.
+        this->table.assign(1 << HUFFMAN_MAX_BITS, HUFFMAN_MAX_BITS);
+
+        for (uint32_t symbol = 0; symbol < this->symbol_count; symbol += 1)
+        {
+            uint32_t bits = this->lengths[symbol];
+            if (bits == 0)
+                continue;
+
+            uint32_t first = this->codes[symbol] << (HUFFMAN_MAX_BITS - bits);
+            std::fill(&this->table[first], &this->table[first] + (1 << (HUFFMAN_MAX_BITS - bits)), (symbol << 4) | bits);
+        }
+    }
+
+    // Bits `symbol` costs, 0 if it has no code.
+    uint32_t get_length(uint32_t symbol) const { return this->lengths[symbol]; }
+
+    void write(BitStream64 &stream, uint32_t symbol) const
+    {
+        stream.write_uint32(this->codes[symbol], this->lengths[symbol]);
+    }
+
+    uint32_t read(BitStream64 &stream) const
+    {
+        uint32_t entry = this->table[stream.peek() >> (64 - HUFFMAN_MAX_BITS)];
+        stream.skip(entry & 15);
+
+        return entry >> 4;
+    }
+
+    // Same as `read`, only valid while `stream.can_peek_fast()` holds.
+    uint32_t read_fast(BitStream64 &stream) const
+    {
+        uint32_t entry = this->table[stream.peek_fast() >> (64 - HUFFMAN_MAX_BITS)];
+        stream.skip(entry & 15);
+
+        return entry >> 4;
+    }
+};
+
+typedef struct sequence_t
+{
+    uint32_t literal_run;
+    uint32_t length;
+    uint32_t offset;
+} sequence_t;
+
+// The tokens of a block as the entropy stage sees them: all literals in one array, and one sequence per pair
+// holding the pair and how many literals came right before it. Literals after the last pair have no sequence.
+class SequenceBuffer
+{
+public:
+    std::vector<uint8_t> literals;
+    std::vector<sequence_t> sequences;
+
+    uint32_t literal_run = 0;
+
+    void clear()
+    {
+        this->literals.clear();
+        this->sequences.clear();
+        this->literal_run = 0;
+    }
+
+    void push_literal(uint8_t byte)
+    {
+        this->literals.push_back(byte);
+        this->literal_run += 1;
+    }
+
+    void push_pair(match_t match)
+    {
+        this->sequences.push_back({this->literal_run, match.length, match.offset});
+        this->literal_run = 0;
+    }
+};
+
+// Framed container written by `encode_frame`, all multi-byte fields little-endian:
+//
+//   header  magic (4) | version (1) | flags (1) | offset_bits (1) | length_bits (1) | minimum_length (1) | block_size (4)
+//   blocks  type (1) | raw stream of the block (7-bit VLQ length + tokens, padded to a byte), or with
+//           BLOCK_TYPE_HUFFMAN the same tokens entropy coded (see `write_entropy_block`)
+//           or BLOCK_TYPE_LZSS_SPLIT a raw stream with the block's own offset and length widths,
+//           or BLOCK_TYPE_STORED the block's bytes as they are
+//   index   stored size (4, type byte included) | original size (4), once per block, which is what lets
+//           `decode_range` find and decode only the blocks it needs
+//   footer  block count (4) | original length (8) | magic (4)
+//
+// Every raw stream in a frame uses the token format given by the FORMAT_ flags in its header.
+//
+// With FRAME_FLAG_CHECKSUMS every index entry ends in the CRC-32C of the block's original bytes (4), and the
+// CRC-32C of the whole original content (4) sits between the index and the footer.
+//
+// A streamed frame (FRAME_FLAG_STREAMED, written by LzssEncoder) has no index or footer, since its length is
+// not known up front. Instead each block is `type (1) | payload size (4) | payload`, and BLOCK_TYPE_END closes it.
+// With FRAME_FLAG_CHECKSUMS the block's CRC-32C follows its payload and the content's the end marker.
+//
+// The magic starts with 0xFF 0x00, which no raw stream can: a 7-bit VLQ never follows a continuation byte with 0.
+static const uint8_t FRAME_MAGIC[4] = {0xFF, 0x00, 'L', 'Z'};
+
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 13
+#define FRAME_INDEX_ENTRY_SIZE 8
+#define FRAME_FOOTER_SIZE 16
+
+// Blocks may reference the last `max_offset` bytes of the block before them.
+#define FRAME_FLAG_LINKED 1
+// Size-prefixed blocks with an end marker instead of an index.
+#define FRAME_FLAG_STREAMED 2
+// CRC-32C of every block and of the whole content, checked when decoding.
+#define FRAME_FLAG_CHECKSUMS 16
+
+#define CHECKSUM_SIZE 4
+
+// Token format options (see `LzssCodec::set_format`). Frames carry the codec's in their flags, at the same bits.
+// Pairs may also be coded as a slot of the RepCache.
+#define FORMAT_REP_MATCHES 4
+// Length fields hold `length - minimum_length`, their largest value escapes to a longer length.
+#define FORMAT_EXTENDED_LENGTHS 8
+#define FORMAT_FLAGS (FORMAT_REP_MATCHES | FORMAT_EXTENDED_LENGTHS)
+
+#define BLOCK_TYPE_LZSS 0
+#define BLOCK_TYPE_HUFFMAN 1
+// A raw stream with its own field widths: type (1) | offset_bits (1) | length_bits (1) | raw stream.
+#define BLOCK_TYPE_LZSS_SPLIT 2
+#define BLOCK_TYPE_STORED 3
+#define BLOCK_TYPE_END 0xFF
+
+// Set in the type byte of a linked frame's block that starts over without history (see `seek_interval`).
+#define BLOCK_FLAG_RESET 0x80
+
+#define STREAM_BLOCK_HEADER_SIZE 5
+
+// A batch written by `encode_batch` holds independent messages, each a raw stream of its own:
+//
+//   record count (VLQ) | per record: stored size (VLQ) | raw stream
+//
+// with byte-aligned VLQs (see `_store_7bit_uint32`), at most BATCH_PREFIX_SIZE bytes each. It has no magic,
+// only `decode_batch` and `split_batch` read it.
+#define BATCH_PREFIX_SIZE 5
+
+// Records are handed to the pool in chunks of about this much data, so a worker's share of the input and
+// output stays in its cache while one set of match finder tables is reused across all of the chunk's records.
+#define BATCH_CHUNK_SIZE (1 << 18)
+
+typedef struct frame_options_t
+{
+    uint32_t block_size = 1 << 20;
+
+    // Worker threads for a pool created just for this call, 0 for one per hardware thread.
+    // Ignored when `pool` is given.
+    uint32_t threads = 0;
+    ThreadPool *pool = NULL;
+
+    bool linked = false;
+
+    // With `linked`, every `seek_interval`-th block starts over without history, so `decode_range` never has
+    // to decode further back than that many blocks. 0 never starts over.
+    uint32_t seek_interval = 0;
+
+    // Huffman code the tokens of every block where that comes out smaller than the raw stream.
+    bool entropy = false;
+
+    // Pick every block's offset and length widths from a trial encode of its start (see `choose_split`).
+    bool adaptive = false;
+
+    // Store blocks that `looks_incompressible` without searching them for matches. Blocks that come out
+    // larger than their bytes are stored either way.
+    bool skip_incompressible = true;
+
+    // Record block and content checksums (see FRAME_FLAG_CHECKSUMS). Each block's is taken by the worker
+    // that encodes it, while the block is still in its cache.
+    bool checksums = false;
+} frame_options_t;
+
+typedef struct frame_info_t
+{
+    uint8_t flags;
+    uint8_t offset_bits;
+    uint8_t length_bits;
+    uint8_t minimum_length;
+    uint32_t block_size;
+
+    uint32_t block_count;
+    uint64_t original_length;
+
+    // Where the block index starts in the frame.
+    uint64_t index_position;
+
+    // With FRAME_FLAG_CHECKSUMS, the content's CRC-32C.
+    uint32_t checksum;
+} frame_info_t;
+
+static inline uint32_t get_frame_index_entry_size(uint8_t flags)
+{
+    return FRAME_INDEX_ENTRY_SIZE + ((flags & FRAME_FLAG_CHECKSUMS) ? CHECKSUM_SIZE : 0);
+}
+
+static inline bool is_frame(Span<const uint8_t> input)
+{
+    return input.length >= FRAME_HEADER_SIZE && memcmp(input.data, FRAME_MAGIC, 4) == 0;
+}
+
+// The incompressibility check samples up to INCOMPRESSIBLE_SAMPLE_SIZE bytes of a block, in chunks spread over it.
+#define INCOMPRESSIBLE_SAMPLE_SIZE (1 << 16)
+#define INCOMPRESSIBLE_SAMPLE_CHUNK 4096
+
+// True when a sample of `block` has a byte distribution about as flat as random data: a collision entropy
+// of 7.9 bits per byte or more, which already compressed or encrypted data has and text never gets near.
+// Such data has no repeats worth a match search. Blocks smaller than a chunk are never flagged.
+static inline bool looks_incompressible(Span<const uint8_t> block)
+{
+    if (block.length < INCOMPRESSIBLE_SAMPLE_CHUNK)
+        return false;
+
+    uint32_t counts[256] = {0};
+    uint64_t chunks = MIN(block.length / INCOMPRESSIBLE_SAMPLE_CHUNK, (size_t)INCOMPRESSIBLE_SAMPLE_SIZE / INCOMPRESSIBLE_SAMPLE_CHUNK);
+    uint64_t stride = block.length / chunks;
+
+    for (uint64_t chunk = 0; chunk < chunks; chunk += 1)
+    {
+        const uint8_t *bytes = block.data + chunk * stride;
+
+        for (uint32_t i = 0; i < INCOMPRESSIBLE_SAMPLE_CHUNK; i += 1)
+            counts[bytes[i]] += 1;
+    }
+
+    uint64_t sampled = chunks * INCOMPRESSIBLE_SAMPLE_CHUNK;
+    uint64_t collisions = 0;
+
+    for (uint32_t count : counts)
+        collisions += (uint64_t)count * count;
+
+    // sum(p^2) <= 2^-7.9, that is 256 * sum(count^2) <= 2^0.1 * sampled^2.
+    return collisions * 256 * 1000 <= sampled * sampled * 1072;
+}
+
+static inline void write_frame_header(uint8_t *bytes, uint8_t flags, uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length, uint32_t block_size)
+{
+    memcpy(bytes, FRAME_MAGIC, 4);
+    bytes[4] = FRAME_VERSION;
+    bytes[5] = flags;
+    bytes[6] = offset_bits;
+    bytes[7] = length_bits;
+    bytes[8] = minimum_length;
+    _store_uint32_le(bytes + 9, block_size);
+}
+
+// Parses and checks the header shared by indexed and streamed frames.
+static inline frame_info_t read_frame_header(Span<const uint8_t> input)
+{
+    if (!is_frame(input) || input[4] != FRAME_VERSION)
+        throw std::invalid_argument("frame");
+
+    frame_info_t frame = {};
+
+    frame.flags = input[5];
+    frame.offset_bits = input[6];
+    frame.length_bits = input[7];
+    frame.minimum_length = input[8];
+    frame.block_size = _load_uint32_le(&input[9]);
+
+    return frame;
+}
+
+// Parses and checks an indexed frame's header and footer.
+static inline frame_info_t read_frame_info(Span<const uint8_t> input)
+{
+    frame_info_t frame = read_frame_header(input);
+
+    if ((frame.flags & FRAME_FLAG_STREAMED) || input.length < FRAME_HEADER_SIZE + FRAME_FOOTER_SIZE)
+        throw std::invalid_argument("frame");
+
+    const uint8_t *footer = input.data + input.length - FRAME_FOOTER_SIZE;
+
+    if (memcmp(footer + 12, FRAME_MAGIC, 4) != 0)
+        throw std::invalid_argument("frame");
+
+    frame.block_count = _load_uint32_le(footer);
+    frame.original_length = _load_uint64_le(footer + 4);
+
+    uint64_t index_size = (uint64_t)frame.block_count * get_frame_index_entry_size(frame.flags);
+    if (frame.flags & FRAME_FLAG_CHECKSUMS)
+        index_size += CHECKSUM_SIZE;
+
+    if (index_size > input.length - FRAME_HEADER_SIZE - FRAME_FOOTER_SIZE)
+        throw std::out_of_range("frame");
+
+    frame.index_position = input.length - FRAME_FOOTER_SIZE - index_size;
+
+    if (frame.flags & FRAME_FLAG_CHECKSUMS)
+        frame.checksum = _load_uint32_le(footer - CHECKSUM_SIZE);
+
+    // Array lengths are 32-bit.
+    if (frame.original_length > 0xFFFFFFFF - MATCH_COPY_SLACK)
+        throw std::length_error("frame");
+
+    return frame;
+}
+
+// A raw stream encoded against a preset dictionary: magic (4) | dictionary ID (4, little-endian) | raw stream.
+// The magic shares FRAME_MAGIC's 0xFF 0x00 prefix, so it can't be mistaken for a raw stream either.
+static const uint8_t DICTIONARY_MAGIC[4] = {0xFF, 0x00, 'L', 'D'};
+
+#define DICTIONARY_HEADER_SIZE 8
+
+static inline bool is_dictionary_stream(Span<const uint8_t> input)
+{
+    return input.length >= DICTIONARY_HEADER_SIZE && memcmp(input.data, DICTIONARY_MAGIC, 4) == 0;
+}
+
+// Bytes the encoder and decoder both treat as coming right before the input, so even the first bytes of a
+// short message can be matches. Only the last `max_offset` bytes are reachable, so the most common content
+// belongs at the end. The ID is written into every stream encoded with it and checked when decoding.
+class LzssDictionary
+{
+private:
+    std::vector<uint8_t> content;
+    uint32_t id;
+
+public:
+    // An `id` of 0 picks a hash (32-bit FNV-1a) of the content.
+    LzssDictionary(Span<const uint8_t> content, uint32_t id = 0) : content(content.data, content.data + content.length)
+    {
+        if (id == 0)
+        {
+            id = 2166136261u;
+            for (size_t i = 0; i < content.length; i += 1)
+                id = (id ^ content[i]) * 16777619u;
+        }
+
+        this->id = id;
+    }
+
+    uint32_t get_id() const { return this->id; }
+
+    Span<const uint8_t> get_content() const { return Span<const uint8_t>(this->content.data(), this->content.size()); }
+
+    // The part of the dictionary a window of `max_offset` bytes can reach.
+    Span<const uint8_t> get_history(uint32_t max_offset) const
+    {
+        size_t length = MIN(this->content.size(), (size_t)max_offset);
+        return Span<const uint8_t>(this->content.data() + this->content.size() - length, length);
+    }
+};
+
+// The structure LzssCodec searches for matches with. Hash chains are fastest for small windows, binary
+// trees keep finding long matches cheaply when the window grows to 16-20 bits. MATCH_FINDER_REFERENCE
+// walks whole hash chains to pick the same matches as the original ports, see `get_reference_level`.
+typedef enum match_finder_t
+{
+    MATCH_FINDER_HASH_CHAIN,
+    MATCH_FINDER_BINARY_TREE,
+    MATCH_FINDER_REFERENCE,
+} match_finder_t;
+
+// Scratch state for encoding and decoding many messages one after another: the match finder's tables
+// and an output buffer, both kept at the size of the largest message seen so far. Starting the next call
+// only moves the finder's base (see HashChain) instead of allocating and clearing 256 KiB of hash heads,
+// which otherwise dominates small messages. Not thread-safe, give every thread its own.
+class LzssContext
+{
+private:
+    template <typename Layout>
+    friend class LzssCodec;
+
+    Allocator *allocator;
+    std::unique_ptr<HashChain> chain;
+    std::unique_ptr<BinaryTree> tree;
+    Array<uint8_t> output;
+
+    // Copy of dictionary history + input for encoding against `dictionary`.
+    std::vector<uint8_t> window;
+    const LzssDictionary *dictionary = NULL;
+
+    HashChain &get_chain(uint8_t offset_bits, uint32_t minimum_length)
+    {
+        if (!this->chain || !this->chain->matches(offset_bits, minimum_length))
+            this->chain.reset(new HashChain(offset_bits, minimum_length));
+
+        return *this->chain;
+    }
+
+    BinaryTree &get_tree(uint8_t offset_bits, uint32_t minimum_length, uint32_t maximum_length, uint32_t depth)
+    {
+        if (!this->tree || !this->tree->matches(offset_bits, minimum_length, maximum_length, depth))
+            this->tree.reset(new BinaryTree(offset_bits, minimum_length, maximum_length, depth));
+
+        return *this->tree;
+    }
+
+    Span<uint8_t> reserve_output(uint64_t size)
+    {
+        // Array lengths are 32-bit, larger messages have to go through the Span overloads.
+        if (size > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        if (this->output.length < size)
+            this->output = Array<uint8_t>(size, this->allocator);
+
+        return this->output;
+    }
+
+public:
+    LzssContext(Allocator *allocator = NULL) : allocator(allocator), output(0, allocator) {}
+
+    // Encodes and decodes every following message against `dictionary`, NULL for none. It must outlive its use.
+    void set_dictionary(const LzssDictionary *dictionary)
+    {
+        this->dictionary = dictionary;
+    }
+
+    // Frees the scratch state; the next call sizes it again from scratch.
+    void release()
+    {
+        this->chain.reset();
+        this->tree.reset();
+        this->output = Array<uint8_t>(0, this->allocator);
+        std::vector<uint8_t>().swap(this->window);
+    }
+};
+
+// With FORMAT_REP_MATCHES a pair token is `1 0 offset length` or `1 1 slot length`, the latter reusing
+// the offset in `slot` of a cache of the last REP_CACHE_SIZE distinct offsets.
+#define REP_CACHE_SIZE 4
+#define REP_SLOT_BITS 2
+
+// A rep match at least this long is taken by the lazy parse without searching the match finder at all.
+#define REP_EARLY_LENGTH 32
+
+// With FORMAT_EXTENDED_LENGTHS a length field of all ones is followed by a VLQ (at least one byte) of how far
+// the length exceeds the longest one the field holds directly. The decoder takes any length that fits its
+// output; the encoder looks for matches of up to EXTENDED_MAXIMUM_LENGTH bytes.
+#define EXTENDED_MAXIMUM_LENGTH (1 << 16)
+
+// The most recently used offsets, newest first. Encoder and decoder update it the same way after every
+// pair, starting over for every raw stream. It starts out as offset 1, valid for any window.
+class RepCache
+{
+public:
+    uint32_t offsets[REP_CACHE_SIZE];
+
+    RepCache()
+    {
+        for (uint32_t &offset : this->offsets)
+            offset = 1;
+    }
+
+    // Moves the offset in `slot` to the front and returns it.
+    uint32_t use(uint32_t slot)
+    {
+        uint32_t offset = this->offsets[slot];
+
+        for (; slot > 0; slot -= 1)
+            this->offsets[slot] = this->offsets[slot - 1];
+
+        this->offsets[0] = offset;
+        return offset;
+    }
+
+    // Puts a new offset in front, dropping the oldest.
+    void push(uint32_t offset)
+    {
+        this->use(REP_CACHE_SIZE - 1);
+        this->offsets[0] = offset;
+    }
+
+    // Encoder side of a pair: returns the slot `offset` was found in, REP_CACHE_SIZE if it had to be pushed.
+    uint32_t update(uint32_t offset)
+    {
+        for (uint32_t slot = 0; slot < REP_CACHE_SIZE; slot += 1)
+        {
+            if (this->offsets[slot] == offset)
+            {
+                this->use(slot);
+                return slot;
+            }
+        }
+
+        this->push(offset);
+        return REP_CACHE_SIZE;
+    }
+};
+
+// Field widths chosen at run time, as `Lzss` has always taken them.
+class DynamicLayout
+{
+protected:
+    uint8_t offset_bits;
+    uint8_t length_bits;
+
+    uint32_t max_offset;
+    uint32_t minimum_length;
+    uint32_t maximum_length;
+
+    // Indexed by the flag bit, so `decode` can pull a literal or a whole pair out of one peek.
+    token_layout_t token_table[2];
+
+public:
+    DynamicLayout(uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length)
+    {
+        // The same range StaticLayout asserts, every mask below is a 32-bit shift.
+        if (offset_bits < 1 || offset_bits > 31 || length_bits < 1 || length_bits > 31)
+            throw std::invalid_argument("field widths");
+
+        this->offset_bits = offset_bits;
+        this->max_offset = (1u << offset_bits) - 1;
+
+        this->minimum_length = minimum_length;
+        this->length_bits = length_bits;
+        this->maximum_length = (1u << length_bits) - 1;
+
+        this->token_table[0] = {9, 64 - 9, 0, 0xFF, 0};
+        this->token_table[1] = {(uint8_t)(1 + offset_bits + length_bits), (uint8_t)(63 - offset_bits), (uint8_t)(63 - offset_bits - length_bits), this->max_offset, this->maximum_length};
+    }
+};
+
+// Field widths fixed at compile time. Every width, mask, shift and fast loop margin derived from them
+// is a constant, so the codec built on top is specialized for exactly this configuration.
+template <uint8_t OffsetBits, uint8_t LengthBits, uint8_t MinimumLength>
+class StaticLayout
+{
+    static_assert(OffsetBits >= 1 && OffsetBits <= 31 && LengthBits >= 1 && LengthBits <= 31, "field widths out of range");
+
+protected:
+    static constexpr uint8_t offset_bits = OffsetBits;
+    static constexpr uint8_t length_bits = LengthBits;
+
+    static constexpr uint32_t max_offset = (1u << OffsetBits) - 1;
+    static constexpr uint32_t minimum_length = MinimumLength;
+    static constexpr uint32_t maximum_length = (1u << LengthBits) - 1;
+
+    static constexpr token_layout_t token_table[2] = {
+        {9, 64 - 9, 0, 0xFF, 0},
+        {1 + OffsetBits + LengthBits, 63 - OffsetBits, 63 - OffsetBits - LengthBits, max_offset, maximum_length},
+    };
+};
+
+template <typename Codec>
+class LzssDecoder;
+
+// Encoder effort. `chain_depth` bounds how many candidates `match_finder` inspects per position,
+// `lazy_steps` how many following positions are tried for a longer match before a found one is taken.
+// `optimal` replaces both with a shortest-path parse over the token bit costs. All of them emit the
+// same format, so the decoder never needs to know which one was used. Shared by every layout, so one
+// level can go to `lzss_dispatch` whichever codec it picks.
+typedef struct lzss_level_t
+{
+    uint32_t chain_depth;
+    uint32_t lazy_steps;
+    bool optimal;
+    match_finder_t match_finder;
+} lzss_level_t;
+
+template <typename Layout>
+class LzssCodec : protected Layout
+{
+public:
+    typedef lzss_level_t level_t;
+
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr int MAX_LEVEL = 9;
+
+    // A greedy parse like the original ports', but over 128-deep hash chains instead of every offset in the
+    // window, so its streams differ from theirs and can be larger: 0.45% over the corpus, 6.8% on ptt5.
+    static constexpr int DEFAULT_LEVEL = 3;
+
+    // Array lengths are 32-bit, with MATCH_COPY_SLACK on top of the decoded bytes.
+    static constexpr uint64_t DEFAULT_DECODE_LIMIT = 0xFFFFFFFF - MATCH_COPY_SLACK;
+
+    // 1-3 greedy and 4-6 lazy over hash chains, 7-9 optimal over binary trees, which find the longest
+    // matches of large windows at a fraction of the cost of deep chains.
+    static level_t get_level(int level)
+    {
+        static const level_t levels[MAX_LEVEL] = {
+            {4, 0, false, MATCH_FINDER_HASH_CHAIN},
+            {16, 0, false, MATCH_FINDER_HASH_CHAIN},
+            {128, 0, false, MATCH_FINDER_HASH_CHAIN},
+            {64, 1, false, MATCH_FINDER_HASH_CHAIN},
+            {128, 1, false, MATCH_FINDER_HASH_CHAIN},
+            {256, 2, false, MATCH_FINDER_HASH_CHAIN},
+            {16, 0, true, MATCH_FINDER_BINARY_TREE},
+            {48, 0, true, MATCH_FINDER_BINARY_TREE},
+            {128, 0, true, MATCH_FINDER_BINARY_TREE},
+        };
+
+        if (level < MIN_LEVEL || level > MAX_LEVEL)
+            throw std::invalid_argument("level");
+
+        return levels[level - 1];
+    }
+
+    // The original ports' greedy parse, for streams byte for byte theirs: every candidate in the window is
+    // compared in full, the longest wins and is only then cut to `maximum_length`, the closest on ties.
+    // Walks every chain to its end, so it slows down with the window as the ports do.
+    static level_t get_reference_level()
+    {
+        return {0xFFFFFFFF, 0, false, MATCH_FINDER_REFERENCE};
+    }
+
+private:
+    // Blocks with their own field widths are encoded by a DynamicLayout codec.
+    template <typename Other>
+    friend class LzssCodec;
+
+    // The optimal parse solves this many positions at a time, so its scratch stays small for any input.
+    static constexpr uint32_t OPTIMAL_BLOCK_SIZE = 1 << 16;
+
+    level_t level;
+
+    // Largest original length a decode accepts from a header, see `set_decode_limit`.
+    uint64_t decode_limit;
+
+    // FORMAT_ flags, see `set_format`.
+    uint8_t format;
+
+    // Bits of a pair token with an explicit offset.
+    uint32_t get_pair_bits() const
+    {
+        return ((this->format & FORMAT_REP_MATCHES) ? 2 : 1) + this->offset_bits + this->length_bits;
+    }
+
+    // Bits of the shortest token there is.
+    uint32_t get_shortest_token_bits() const
+    {
+        uint32_t bits = MIN(9u, this->get_pair_bits());
+
+        return (this->format & FORMAT_REP_MATCHES) ? MIN(bits, 2u + REP_SLOT_BITS + this->length_bits) : bits;
+    }
+
+    // Longest match a length field holds without an extension.
+    uint32_t get_longest_plain_length() const
+    {
+        return (this->format & FORMAT_EXTENDED_LENGTHS) ? this->maximum_length - 1 + this->minimum_length : this->maximum_length;
+    }
+
+    // Longest match the encoder looks for.
+    uint32_t get_match_limit() const
+    {
+        return (this->format & FORMAT_EXTENDED_LENGTHS) ? EXTENDED_MAXIMUM_LENGTH : this->maximum_length;
+    }
+
+    // Bits a pair of `length` bytes takes on top of `get_pair_bits`: its extension, if it needs one.
+    uint32_t get_extension_bits(uint32_t length) const
+    {
+        if (length <= this->get_longest_plain_length())
+            return 0;
+
+        uint32_t bits = 8;
+        for (uint32_t rest = (length - this->minimum_length - this->maximum_length) >> 7; rest > 0; rest >>= 7)
+            bits += 8;
+
+        return bits;
+    }
+
+    void write_length(BitStream64 &stream, uint32_t length) const
+    {
+        if (!(this->format & FORMAT_EXTENDED_LENGTHS))
+        {
+            stream.write_uint32(length, this->length_bits);
+            return;
+        }
+
+        uint32_t code = length - this->minimum_length;
+        stream.write_uint32(MIN(code, this->maximum_length), this->length_bits);
+
+        if (code < this->maximum_length)
+            return;
+
+        // Unlike the header's VLQ, an extension of 0 still takes a byte.
+        uint32_t rest = code - this->maximum_length;
+        for (; rest > 127; rest >>= 7)
+            stream.write_uint32(128 | (rest & 127), 8);
+
+        stream.write_uint32(rest, 8);
+    }
+
+    // Turns a read length field into the match length, reading the extension it escapes to.
+    uint64_t read_length(BitStream64 &stream, uint32_t code) const
+    {
+        if (!(this->format & FORMAT_EXTENDED_LENGTHS))
+            return code;
+
+        uint64_t length = (uint64_t)code + this->minimum_length;
+        return code == this->maximum_length ? length + stream.read_7bit_uint32() : length;
+    }
+
+    template <typename Finder>
+    match_t get_longest_match(Finder &chain, Span<const uint8_t> input, uint32_t index) const
+    {
+        if (index + this->minimum_length >= input.length)
+            return _create_match(0, 0);
+
+        LZSS_STAT(StatsTimer timer(lzss_stats().search_ns); lzss_stats().searches += 1;)
+
+        match_t match;
+
+        if (this->level.match_finder == MATCH_FINDER_REFERENCE)
+        {
+            match = chain.find(input, index, this->max_offset, 0xFFFFFFFF, this->level.chain_depth);
+            match.length = MIN(match.length, this->maximum_length);
+        }
+        else
+            match = chain.find(input, index, this->max_offset, this->maximum_length, this->level.chain_depth);
+
+        // The finder stops at `maximum_length`, which keeps a binary tree's work per position the same in
+        // every format. A match that got there is extended from its end, one compare however long it gets.
+        if ((this->format & FORMAT_EXTENDED_LENGTHS) && match.length == this->maximum_length)
+        {
+            uint32_t limit = MIN(this->get_match_limit(), (uint32_t)input.length - index);
+            const uint8_t *current = &input[index + match.length];
+
+            match.length += match_length(current - match.offset, current, limit - match.length);
+        }
+
+        return match;
+    }
+
+    // Longest match at one of the cached offsets, only a few compares and no finder lookup.
+    match_t get_rep_match(Span<const uint8_t> input, uint32_t index, const RepCache &reps) const
+    {
+        match_t best = _create_match(0, 0);
+
+        if (index + this->minimum_length >= input.length)
+            return best;
+
+        uint32_t limit = MIN(this->get_match_limit(), (uint32_t)input.length - index);
+
+        for (uint32_t offset : reps.offsets)
+        {
+            if (offset > index || offset == best.offset)
+                continue;
+
+            uint32_t length = match_length(&input[index - offset], &input[index], limit);
+            if (length > best.length)
+                best = _create_match(offset, length);
+        }
+
+        return best;
+    }
+
+    void write_literal(BitStream64 &stream, uint8_t byte) const
+    {
+        LZSS_STAT(StatsTimer timer(lzss_stats().bitstream_ns); lzss_stats().literals += 1;)
+
+        stream.write_bit(false);
+        stream.write_uint32(byte, 8);
+    }
+
+    // `reps` is only used, and kept up to date, with FORMAT_REP_MATCHES.
+    void write_pair(BitStream64 &stream, match_t match, RepCache &reps) const
+    {
+        LZSS_STAT(StatsTimer timer(lzss_stats().bitstream_ns); lzss_stats().add_pair(match.length, match.offset);)
+
+        stream.write_bit(true);
+
+        if (this->format & FORMAT_REP_MATCHES)
+        {
+            uint32_t slot = reps.update(match.offset);
+
+            stream.write_bit(slot < REP_CACHE_SIZE);
+
+            if (slot < REP_CACHE_SIZE)
+            {
+                LZSS_STAT(lzss_stats().rep_pairs += 1;)
+
+                stream.write_uint32(slot, REP_SLOT_BITS);
+                this->write_length(stream, match.length);
+                return;
+            }
+        }
+
+        stream.write_uint32(match.offset, this->offset_bits);
+        this->write_length(stream, match.length);
+    }
+
+    void write_literal(SequenceBuffer &sequences, uint8_t byte) const
+    {
+        sequences.push_literal(byte);
+    }
+
+    // Buffered pairs keep their offsets, `reps` only follows along for the parser's rep match lookups.
+    void write_pair(SequenceBuffer &sequences, match_t match, RepCache &reps) const
+    {
+        if (this->format & FORMAT_REP_MATCHES)
+            reps.update(match.offset);
+
+        sequences.push_pair(match);
+    }
+
+    // Writes buffered tokens as the raw token stream the parser would have written directly. Buffered
+    // tokens only show up in the statistics once written here.
+    void write_sequences(const SequenceBuffer &sequences, BitStream64 &stream) const
+    {
+        RepCache reps;
+        uint32_t literal = 0;
+
+        for (const sequence_t &sequence : sequences.sequences)
+        {
+            for (uint32_t end = literal + sequence.literal_run; literal < end; literal += 1)
+                this->write_literal(stream, sequences.literals[literal]);
+
+            this->write_pair(stream, _create_match(sequence.offset, sequence.length), reps);
+        }
+
+        for (; literal < sequences.literals.size(); literal += 1)
+            this->write_literal(stream, sequences.literals[literal]);
+    }
+
+    // Payload of a BLOCK_TYPE_HUFFMAN block, `length` bytes of tokens buffered in `sequences`:
+    //
+    //   counts     original size (4) | literal count (4) | sequence count (4)
+    //   literals   code lengths (128) | stream sizes (4 x 4) | 4 Huffman streams, one per quarter of the literals
+    //   sequences  run, length and offset code lengths (3 x 36) | one stream of `run length offset` per sequence
+    //
+    // Runs, lengths less `minimum_length` and offsets less one are coded as buckets plus extra bits.
+    // Literals after the last sequence are implied by the literal count.
+    void write_entropy_block(const SequenceBuffer &sequences, uint32_t length, std::vector<uint8_t> &output) const
+    {
+        uint32_t literal_count = sequences.literals.size();
+        uint32_t sequence_count = sequences.sequences.size();
+
+        uint32_t literal_frequencies[256] = {0};
+        uint32_t run_frequencies[ENTROPY_BUCKETS] = {0};
+        uint32_t length_frequencies[ENTROPY_BUCKETS] = {0};
+        uint32_t offset_frequencies[ENTROPY_BUCKETS] = {0};
+
+        for (uint8_t literal : sequences.literals)
+            literal_frequencies[literal] += 1;
+
+        for (const sequence_t &sequence : sequences.sequences)
+        {
+            run_frequencies[_value_bucket(sequence.literal_run)] += 1;
+            length_frequencies[_value_bucket(sequence.length - this->minimum_length)] += 1;
+            offset_frequencies[_value_bucket(sequence.offset - 1)] += 1;
+        }
+
+        Huffman literals(256), runs(ENTROPY_BUCKETS), lengths(ENTROPY_BUCKETS), offsets(ENTROPY_BUCKETS);
+        literals.build(literal_frequencies);
+        runs.build(run_frequencies);
+        lengths.build(length_frequencies);
+        offsets.build(offset_frequencies);
+
+        // Every stream may end with a partial 64-bit word, and a sequence takes at most 3 x (12 + 30) bits.
+        uint32_t header_size = 12 + literals.get_table_size() + 16 + 3 * runs.get_table_size();
+        output.resize(header_size + 6 * 8 + ((uint64_t)literal_count * HUFFMAN_MAX_BITS) / 8 + (uint64_t)sequence_count * 16);
+
+        uint8_t *bytes = output.data();
+        _store_uint32_le(bytes, length);
+        _store_uint32_le(bytes + 4, literal_count);
+        _store_uint32_le(bytes + 8, sequence_count);
+
+        size_t position = 12;
+        literals.write_table(bytes + position);
+        position += literals.get_table_size();
+
+        size_t sizes = position;
+        position += 16;
+
+        uint32_t quarter = (literal_count + 3) / 4;
+        for (uint32_t part = 0; part < 4; part += 1)
+        {
+            BitStream64 stream(Span<uint8_t>(bytes + position, output.size() - position));
+
+            for (uint32_t i = part * quarter, end = MIN(literal_count, i + quarter); i < end; i += 1)
+                literals.write(stream, sequences.literals[i]);
+
+            stream.flush();
+
+            _store_uint32_le(bytes + sizes + part * 4, stream.buffer_position);
+            position += stream.buffer_position;
+        }
+
+        for (const Huffman *code : {&runs, &lengths, &offsets})
+        {
+            code->write_table(bytes + position);
+            position += code->get_table_size();
+        }
+
+        BitStream64 stream(Span<uint8_t>(bytes + position, output.size() - position));
+
+        auto write_value = [&](const Huffman &code, uint32_t value)
+        {
+            uint32_t bucket = _value_bucket(value);
+
+            code.write(stream, bucket);
+            stream.write_uint32(value - _bucket_base(bucket), _bucket_extra_bits(bucket));
+        };
+
+        for (const sequence_t &sequence : sequences.sequences)
+        {
+            write_value(runs, sequence.literal_run);
+            write_value(lengths, sequence.length - this->minimum_length);
+            write_value(offsets, sequence.offset - 1);
+        }
+
+        stream.flush();
+        output.resize(position + stream.buffer_position);
+    }
+
+    // Decodes a BLOCK_TYPE_HUFFMAN payload into `output`, `length` bytes. Matches may reach `history` bytes
+    // back before `output`; `has_slack` works as for `decode_tokens`.
+    void decode_entropy_block(Span<const uint8_t> input, uint8_t *output, uint32_t length, uint64_t history, bool has_slack) const
+    {
+        Huffman literals(256), runs(ENTROPY_BUCKETS), lengths(ENTROPY_BUCKETS), offsets(ENTROPY_BUCKETS);
+
+        size_t position = 12 + literals.get_table_size() + 16;
+        if (input.length < position || _load_uint32_le(&input[0]) != length)
+            throw std::invalid_argument("block");
+
+        uint32_t literal_count = _load_uint32_le(&input[4]);
+        uint32_t sequence_count = _load_uint32_le(&input[8]);
+
+        if (literal_count > length || sequence_count > length)
+            throw std::invalid_argument("block");
+
+        literals.read_table(&input[12]);
+
+        // Literals are decoded up front, the four streams interleaved so their lookups overlap.
+        std::vector<uint8_t> decoded(literal_count);
+        std::vector<BitStream64> streams;
+        uint32_t quarter = (literal_count + 3) / 4;
+        uint32_t counts[4];
+
+        for (uint32_t part = 0; part < 4; part += 1)
+        {
+            uint32_t size = _load_uint32_le(&input[12 + literals.get_table_size() + part * 4]);
+
+            if (size > input.length - position)
+                throw std::out_of_range("block");
+
+            streams.emplace_back(input.subspan(position, size));
+            position += size;
+
+            counts[part] = MIN(literal_count - MIN(literal_count, part * quarter), quarter);
+        }
+
+        uint32_t index = 0;
+        uint8_t *parts[4];
+        for (uint32_t part = 0; part < 4; part += 1)
+            parts[part] = decoded.data() + MIN(literal_count, part * quarter);
+
+        for (; index < counts[3] && streams[0].can_peek_fast() && streams[1].can_peek_fast() && streams[2].can_peek_fast() && streams[3].can_peek_fast(); index += 1)
+        {
+            parts[0][index] = literals.read_fast(streams[0]);
+            parts[1][index] = literals.read_fast(streams[1]);
+            parts[2][index] = literals.read_fast(streams[2]);
+            parts[3][index] = literals.read_fast(streams[3]);
+        }
+
+        for (uint32_t part = 0; part < 4; part += 1)
+        {
+            for (uint32_t i = index; i < counts[part]; i += 1)
+                parts[part][i] = literals.read(streams[part]);
+
+            if (streams[part].read_position() > _load_uint32_le(&input[12 + literals.get_table_size() + part * 4]))
+                throw std::out_of_range("block");
+        }
+
+        if (input.length - position < 3 * runs.get_table_size())
+            throw std::out_of_range("block");
+
+        for (Huffman *code : {&runs, &lengths, &offsets})
+        {
+            code->read_table(&input[position]);
+            position += code->get_table_size();
+        }
+
+        BitStream64 stream(input.subspan(position, input.length - position));
+
+        auto read_value = [&](const Huffman &code)
+        {
+            uint32_t bucket = code.read(stream);
+
+            if (bucket >= ENTROPY_BUCKETS)
+                throw std::invalid_argument("block");
+
+            return _bucket_base(bucket) + stream.read_uint32(_bucket_extra_bits(bucket));
+        };
+
+        uint32_t literal = 0;
+        uint64_t written = 0;
+
+        for (uint32_t sequence = 0; sequence < sequence_count; sequence += 1)
+        {
+            uint64_t run = read_value(runs);
+            uint64_t match_length = (uint64_t)read_value(lengths) + this->minimum_length;
+            uint64_t offset = (uint64_t)read_value(offsets) + 1;
+
+            if (run > literal_count - literal || written + run + match_length > length || offset > written + run + history)
+                throw std::invalid_argument("block");
+
+            if (run > 0)
+                memcpy(output + written, decoded.data() + literal, run);
+
+            literal += run;
+            written += run;
+
+            uint8_t *destination = output + written;
+
+            if (has_slack || written + match_length + MATCH_COPY_SLACK <= length)
+                _copy_match(destination, offset, match_length);
+            else
+                for (uint32_t i = 0; i < match_length; i += 1)
+                    destination[i] = destination[i - (int64_t)offset];
+
+            written += match_length;
+        }
+
+        if (stream.read_position() > input.length - position || written + (literal_count - literal) != length)
+            throw std::invalid_argument("block");
+
+        if (literal < literal_count)
+            memcpy(output + written, decoded.data() + literal, literal_count - literal);
+    }
+
+    // Trial encodes this many bytes of a block for every `offset_bits`/`length_bits` candidate.
+    static constexpr uint32_t ADAPTIVE_SAMPLE_SIZE = 1 << 15;
+
+    // The same codec, level and format with other field widths.
+    LzssCodec<DynamicLayout> with_split(uint8_t offset_bits, uint8_t length_bits) const
+    {
+        const level_t &level = this->level;
+        LzssCodec<DynamicLayout> codec(DynamicLayout(offset_bits, length_bits, this->minimum_length), {level.chain_depth, level.lazy_steps, level.optimal, level.match_finder});
+
+        codec.decode_limit = this->decode_limit;
+        codec.format = this->format;
+
+        return codec;
+    }
+
+    // Returns the field widths that encode the first ADAPTIVE_SAMPLE_SIZE bytes of `input[start..]` in the
+    // fewest raw stream bits. Candidates are the codec's own widths and those up to 4 offset and 2 length bits
+    // away, without offsets wider than `input` needs: the hash chain grows with the window.
+    std::pair<uint8_t, uint8_t> choose_split(Span<const uint8_t> input, uint32_t start) const
+    {
+        Span<const uint8_t> sample = input.subspan(0, start + MIN(ADAPTIVE_SAMPLE_SIZE, (uint32_t)input.length - start));
+
+        std::pair<uint8_t, uint8_t> best(this->offset_bits, this->length_bits);
+        uint64_t best_bits = 0xFFFFFFFFFFFFFFFF;
+        SequenceBuffer sequences;
+
+        for (int offset_bits = this->offset_bits - 4; offset_bits <= this->offset_bits + 4; offset_bits += 2)
+        {
+            if (offset_bits < 1 || (offset_bits > this->offset_bits && (offset_bits > 24 || (1ull << (offset_bits - 1)) >= input.length)))
+                continue;
+
+            for (int length_bits = this->length_bits - 2; length_bits <= this->length_bits + 2; length_bits += 2)
+            {
+                if (length_bits < 1 || (length_bits > this->length_bits && length_bits > 16))
+                    continue;
+
+                LzssCodec<DynamicLayout> codec = this->with_split(offset_bits, length_bits);
+
+                sequences.clear();
+                codec.encode_tokens(sample, start, sequences);
+
+                uint64_t bits = (uint64_t)sequences.literals.size() * 9 + (uint64_t)sequences.sequences.size() * codec.get_pair_bits();
+
+                // Ties keep the codec's own widths, which were tried first along their row.
+                if (bits < best_bits || (bits == best_bits && offset_bits == this->offset_bits && length_bits == this->length_bits))
+                {
+                    best = std::make_pair(offset_bits, length_bits);
+                    best_bits = bits;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    // Writes the block for `input[start..]` into `slot`, type byte first, and returns its size. With `split`
+    // a raw stream is written as BLOCK_TYPE_LZSS_SPLIT, carrying this codec's field widths.
+    size_t encode_block(Span<const uint8_t> input, uint32_t start, Span<uint8_t> slot, bool entropy, bool split) const
+    {
+        uint32_t header = split ? 3 : 1;
+        uint32_t length = input.length - start;
+
+        BitStream64 stream(slot.subspan(header, slot.length - header));
+
+        slot[0] = split ? BLOCK_TYPE_LZSS_SPLIT : BLOCK_TYPE_LZSS;
+        if (split)
+        {
+            slot[1] = this->offset_bits;
+            slot[2] = this->length_bits;
+        }
+
+        stream.write_7bit_uint32(length);
+
+        if (!entropy)
+        {
+            this->encode_tokens(input, start, stream);
+            stream.flush();
+
+            return header + stream.buffer_position;
+        }
+
+        // Parsed once, then written both ways. The smaller one always fits the slot since the raw one does.
+        SequenceBuffer sequences;
+        std::vector<uint8_t> coded;
+
+        this->encode_tokens(input, start, sequences);
+        this->write_sequences(sequences, stream);
+        stream.flush();
+
+        this->write_entropy_block(sequences, length, coded);
+
+        if (coded.size() + 1 >= header + stream.buffer_position)
+            return header + stream.buffer_position;
+
+        slot[0] = BLOCK_TYPE_HUFFMAN;
+        memcpy(&slot[1], coded.data(), coded.size());
+
+        return 1 + coded.size();
+    }
+
+    // Greedy parse when `lazy_steps` is 0. Otherwise a found match is only taken if none starting up to
+    // `lazy_steps` bytes later covers more than the bytes skipped over to reach it; those become literals.
+    // With FORMAT_REP_MATCHES the cached offsets are tried first: a long rep match skips the finder, a
+    // shorter one still wins over a found match at most a byte longer, since its token is much smaller.
+    template <typename Finder, typename Sink>
+    void encode_lazy(Span<const uint8_t> input, uint32_t start, Sink &stream, Finder &chain) const
+    {
+        RepCache reps;
+        uint32_t inserted = start;
+
+        // Positions are linked in lazily, a lookup must never see its own position.
+        auto find = [&](uint32_t index)
+        {
+            for (; inserted < index; inserted += 1)
+                chain.insert(input, inserted);
+
+            if (!(this->format & FORMAT_REP_MATCHES))
+                return this->get_longest_match(chain, input, index);
+
+            match_t rep = this->get_rep_match(input, index, reps);
+
+            if (rep.length >= MIN(REP_EARLY_LENGTH, this->get_match_limit()))
+            {
+                LZSS_STAT(lzss_stats().rep_early_hits += 1;)
+                return rep;
+            }
+
+            match_t match = this->get_longest_match(chain, input, index);
+            return (rep.length >= this->minimum_length && rep.length + 1 >= match.length) ? rep : match;
+        };
+
+        for (uint32_t index = start; index < input.length;)
+        {
+            match_t match = find(index);
+
+            if (match.length < this->minimum_length)
+            {
+                this->write_literal(stream, input[index]);
+                index += 1;
+                continue;
+            }
+
+            // Looking past the end of the current match is pointless, the next iteration starts there anyway.
+            for (uint32_t step = 1; step <= this->level.lazy_steps && step < match.length; step += 1)
+            {
+                match_t next = find(index + step);
+
+                if (next.length >= match.length + step)
+                {
+                    for (uint32_t end = index + step; index < end; index += 1)
+                        this->write_literal(stream, input[index]);
+
+                    match = next;
+                    step = 0;
+                }
+            }
+
+            this->write_pair(stream, match, reps);
+            index += match.length;
+        }
+    }
+
+    // Shortest path over the token graph: every position links to the next with a literal, and to each end
+    // of its longest match with a pair. Offsets have a fixed width, so every prefix of the longest match
+    // costs the same and no other candidate can do better. Solved per OPTIMAL_BLOCK_SIZE positions, with
+    // matches cut at the block end. Rep matches depend on the path taken, so the costs leave them out;
+    // pairs on the chosen path that hit the cache still get their short code when written. A match longer
+    // than a length field holds is taken outright, and of the positions it covers only the last
+    // `maximum_length` are linked in, none searched: a long run costs about as much as a short match.
+    template <typename Finder, typename Sink>
+    void encode_optimal(Span<const uint8_t> input, uint32_t start, Sink &stream, Finder &chain) const
+    {
+        const uint32_t literal_bits = 9;
+        const uint32_t pair_bits = this->get_pair_bits();
+        const uint32_t shortest = MAX(this->minimum_length, 1);
+        const uint32_t longest_plain = this->get_longest_plain_length();
+
+        std::vector<uint32_t> cost, offsets, steps, path;
+        RepCache reps;
+
+        for (uint32_t block = start; block < input.length;)
+        {
+            uint32_t block_length = MIN(OPTIMAL_BLOCK_SIZE, input.length - block);
+
+            // `steps[i]` is the length of the pair that reaches `i` on the cheapest path, 0 for a literal.
+            cost.assign(block_length + 1, 0xFFFFFFFF);
+            offsets.resize(block_length);
+            steps.resize(block_length + 1);
+            cost[0] = 0;
+
+            for (uint32_t i = 0; i < block_length; i += 1)
+            {
+                match_t match = this->get_longest_match(chain, input, block + i);
+                chain.insert(input, block + i);
+
+                if (cost[i] + literal_bits < cost[i + 1])
+                {
+                    cost[i + 1] = cost[i] + literal_bits;
+                    steps[i + 1] = 0;
+                }
+
+                offsets[i] = match.offset;
+
+                uint32_t end = MIN(match.length, block_length - i);
+
+                for (uint32_t length = shortest; length <= MIN(end, longest_plain); length += 1)
+                {
+                    if (cost[i] + pair_bits < cost[i + length])
+                    {
+                        cost[i + length] = cost[i] + pair_bits;
+                        steps[i + length] = length;
+                    }
+                }
+
+                if (end > longest_plain)
+                {
+                    if (cost[i] + pair_bits + this->get_extension_bits(end) < cost[i + end])
+                    {
+                        cost[i + end] = cost[i] + pair_bits + this->get_extension_bits(end);
+                        steps[i + end] = end;
+                    }
+
+                    for (uint32_t covered = MAX(i + 1, i + end - MIN(end, this->maximum_length)); covered < i + end; covered += 1)
+                        chain.insert(input, block + covered);
+
+                    i += end - 1;
+                }
+            }
+
+            path.clear();
+            for (uint32_t i = block_length; i > 0; i -= MAX(steps[i], 1))
+                path.push_back(i);
+
+            for (uint32_t k = path.size(), i = 0; k > 0; k -= 1)
+            {
+                uint32_t end = path[k - 1];
+
+                if (steps[end] == 0)
+                    this->write_literal(stream, input[block + i]);
+                else
+                    this->write_pair(stream, _create_match(offsets[i], steps[end]), reps);
+
+                i = end;
+            }
+
+            block += block_length;
+        }
+    }
+
+    // Calls `callback` with `context`'s match finder for this codec's level.
+    template <typename Callback>
+    void with_finder(LzssContext &context, Callback &&callback) const
+    {
+        if (this->level.match_finder == MATCH_FINDER_BINARY_TREE)
+            callback(context.get_tree(this->offset_bits, this->minimum_length, this->maximum_length, this->level.chain_depth));
+        else
+            callback(context.get_chain(this->offset_bits, this->minimum_length));
+    }
+
+    // Writes the raw stream for `input` into `output` with `finder` and returns its size.
+    template <typename Finder>
+    size_t encode_raw(Span<const uint8_t> input, Span<uint8_t> output, Finder &finder) const
+    {
+        BitStream64 stream(output);
+
+        stream.write_7bit_uint32(input.length);
+        this->encode_tokens(input, 0, stream, finder);
+
+        stream.flush();
+
+        return stream.buffer_position;
+    }
+
+    // Decodes a raw stream into `output`, throws std::out_of_range if it doesn't fit.
+    size_t decode_raw(Span<const uint8_t> input, Span<uint8_t> output) const
+    {
+        BitStream64 stream(input);
+        uint32_t original_length = this->read_original_length(input, stream);
+
+        if (original_length > output.length)
+            throw std::out_of_range("output");
+
+        this->decode_tokens(stream, output.data, original_length, 0, output.length - original_length >= MATCH_COPY_SLACK);
+
+        return original_length;
+    }
+
+    // Splits `count` records into runs of about BATCH_CHUNK_SIZE bytes by `length(record)`, returns where
+    // each run starts plus `count` at the end.
+    template <typename Length>
+    static std::vector<uint32_t> get_batch_chunks(uint32_t count, Length &&length)
+    {
+        std::vector<uint32_t> chunks(1, 0);
+        uint64_t filled = 0;
+
+        for (uint32_t record = 0; record < count; record += 1)
+        {
+            filled += length(record);
+
+            if (filled >= BATCH_CHUNK_SIZE && record + 1 < count)
+            {
+                chunks.push_back(record + 1);
+                filled = 0;
+            }
+        }
+
+        chunks.push_back(count);
+        return chunks;
+    }
+
+    // Runs `body` for every chunk `get_batch_chunks` made across `pool`, or one made for the call if NULL.
+    // Spawning threads costs more than coding a single chunk takes, so a lone chunk runs on the calling thread.
+    static void for_batch_chunks(ThreadPool *pool, uint32_t chunk_count, const std::function<void(uint32_t)> &body)
+    {
+        ThreadPool local_pool(pool == NULL && chunk_count > 1 ? 0 : 1);
+        (pool == NULL ? local_pool : *pool).parallel_for(chunk_count, body);
+    }
+
+    // Moves the `stored_sizes` bytes written at the start of each slot together, from `position` on, and
+    // returns where they end. Slots only ever move towards the front, so packing them in order never
+    // overwrites an unread one.
+    template <typename Size>
+    static uint64_t pack_slots(uint8_t *bytes, uint64_t position, const std::vector<uint64_t> &slots, const std::vector<Size> &stored_sizes)
+    {
+        for (size_t slot = 0; slot < stored_sizes.size(); slot += 1)
+        {
+            memmove(bytes + position, bytes + slots[slot], stored_sizes[slot]);
+            position += stored_sizes[slot];
+        }
+
+        return position;
+    }
+
+    // Encodes `input` with the dictionary's history in front of it, copied together into `window`.
+    template <typename Finder>
+    size_t encode_dictionary(Span<const uint8_t> input, Span<uint8_t> output, const LzssDictionary &dictionary, Finder &finder, std::vector<uint8_t> &window) const
+    {
+        if (input.length > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        if (output.length < DICTIONARY_HEADER_SIZE)
+            throw std::out_of_range("output");
+
+        Span<const uint8_t> history = dictionary.get_history(this->max_offset);
+
+        window.resize(history.length + input.length);
+        std::copy(history.data, history.data + history.length, window.begin());
+        std::copy(input.data, input.data + input.length, window.begin() + history.length);
+
+        memcpy(output.data, DICTIONARY_MAGIC, 4);
+        _store_uint32_le(output.data + 4, dictionary.get_id());
+
+        BitStream64 stream(output.subspan(DICTIONARY_HEADER_SIZE, output.length - DICTIONARY_HEADER_SIZE));
+
+        stream.write_7bit_uint32(input.length);
+        this->encode_tokens(Span<const uint8_t>(window.data(), window.size()), history.length, stream, finder);
+
+        stream.flush();
+
+        return DICTIONARY_HEADER_SIZE + stream.buffer_position;
+    }
+
+    // Checks that a dictionary stream was encoded against `dictionary` and returns the raw stream that follows its header.
+    static Span<const uint8_t> open_dictionary_stream(Span<const uint8_t> input, const LzssDictionary *dictionary)
+    {
+        if (dictionary == NULL || _load_uint32_le(&input[4]) != dictionary->get_id())
+            throw std::invalid_argument("dictionary");
+
+        return input.subspan(DICTIONARY_HEADER_SIZE, input.length - DICTIONARY_HEADER_SIZE);
+    }
+
+    // The fast loop of `decode_tokens` from `index` up to `end`. With `CheckOffsets` every pair's offset
+    // is checked against the `history` bytes before `output`; past the first `max_offset` bytes of history
+    // and output no offset can reach too far, so the rest runs without. An offset of 0 is rejected in both,
+    // it would copy the output onto itself and return whatever the buffer held before. Cached offsets are earlier pairs'
+    // or 1, so rep matches are covered by the same bound. `Format` is the codec's, as a constant: the plain
+    // format keeps its table driven loop. An extended length can run past `end`, so it is checked against
+    // `length`, and copied wide only as far as the `capacity` bytes writable from `output` allow.
+    template <bool CheckOffsets, uint8_t Format>
+    uint32_t decode_tokens_loop(BitStream64 &stream, uint8_t *output, uint32_t index, uint32_t end, uint32_t length, uint64_t capacity, uint64_t history, RepCache &reps) const
+    {
+        LZSS_STAT(uint64_t literals = 0; uint64_t pairs = 0;)
+
+        while (index < end && stream.can_peek_fast())
+        {
+            uint64_t window = stream.peek_fast();
+            bool is_pair = window >> 63;
+
+            if (Format != 0 && is_pair)
+            {
+                constexpr uint32_t flag_bits = (Format & FORMAT_REP_MATCHES) ? 2 : 1;
+                uint32_t offset, code;
+
+                if ((Format & FORMAT_REP_MATCHES) && ((window >> 62) & 1))
+                {
+                    offset = reps.use((window >> (62 - REP_SLOT_BITS)) & (REP_CACHE_SIZE - 1));
+                    code = (window >> (62 - REP_SLOT_BITS - this->length_bits)) & this->maximum_length;
+                    stream.skip(2 + REP_SLOT_BITS + this->length_bits);
+                }
+                else
+                {
+                    offset = (window >> (64 - flag_bits - this->offset_bits)) & this->max_offset;
+                    code = (window >> (64 - flag_bits - this->offset_bits - this->length_bits)) & this->maximum_length;
+                    stream.skip(flag_bits + this->offset_bits + this->length_bits);
+
+                    if (Format & FORMAT_REP_MATCHES)
+                        reps.push(offset);
+                }
+
+                if (offset == 0 || (CheckOffsets && offset > index + history))
+                    throw std::invalid_argument("stream");
+
+                LZSS_STAT(pairs += 1;)
+
+                if ((Format & FORMAT_EXTENDED_LENGTHS) && code == this->maximum_length)
+                {
+                    uint64_t match_length = this->read_length(stream, code);
+
+                    if (match_length > length - index)
+                        throw std::invalid_argument("stream");
+
+                    _copy_match_within(output + index, offset, match_length, capacity - index);
+                    index += match_length;
+                    continue;
+                }
+
+                uint32_t match_length = (Format & FORMAT_EXTENDED_LENGTHS) ? code + this->minimum_length : code;
+
+                _copy_match(output + index, offset, match_length);
+                index += match_length;
+                continue;
+            }
+
+            const token_layout_t &token = this->token_table[is_pair];
+
+            uint32_t first = (window >> token.first_shift) & token.first_mask;
+            uint32_t second = (window >> token.second_shift) & token.second_mask;
+            stream.skip(token.bits);
+
+            if (is_pair)
+            {
+                if (first == 0 || (CheckOffsets && first > index + history))
+                    throw std::invalid_argument("stream");
+
+                _copy_match(output + index, first, second);
+                index += second;
+                LZSS_STAT(pairs += 1;)
+            }
+            else
+            {
+                output[index] = first;
+                index += 1;
+                LZSS_STAT(literals += 1;)
+            }
+        }
+
+        LZSS_STAT(lzss_stats().literals_decoded += literals; lzss_stats().pairs_decoded += pairs;)
+
+        return index;
+    }
+
+    // Both passes of the fast loop, with and then without offset checks, up to `fast_end`.
+    template <uint8_t Format>
+    uint32_t decode_tokens_fast(BitStream64 &stream, uint8_t *output, uint32_t checked_end, uint32_t fast_end, uint32_t length, uint64_t capacity, uint64_t history, RepCache &reps) const
+    {
+        uint32_t index = this->template decode_tokens_loop<true, Format>(stream, output, 0, checked_end, length, capacity, history, reps);
+
+        if (index >= checked_end)
+            index = this->template decode_tokens_loop<false, Format>(stream, output, index, fast_end, length, capacity, history, reps);
+
+        return index;
+    }
+
+    // Reads a raw stream's length header. It is checked against the decode limit and against what the rest of
+    // `input` could expand to at most, so a forged header can't make a caller allocate for more than the stream
+    // can fill. An empty input encodes to an empty stream, since a length of 0 takes no VLQ bytes.
+    uint32_t read_original_length(Span<const uint8_t> input, BitStream64 &stream) const
+    {
+        if (input.length == 0)
+            return 0;
+
+        uint32_t original_length = stream.read_7bit_uint32();
+
+        if (original_length > this->decode_limit || original_length > this->get_max_decoded_length(input.length - stream.read_position()))
+            throw std::length_error("stream");
+
+        return original_length;
+    }
+
+    // A dictionary stream decodes after its history, so the two together are held to the decode limit, which
+    // also keeps them and MATCH_COPY_SLACK within a 32-bit Array.
+    void check_dictionary_window(Span<const uint8_t> history, uint32_t original_length) const
+    {
+        if ((uint64_t)history.length + original_length > this->decode_limit)
+            throw std::length_error("stream");
+    }
+
+    // Most bytes a frame block, type byte first, can decode to. Entropy coded lengths have no field width to
+    // bound them, so a BLOCK_TYPE_HUFFMAN block is only held to the size its payload starts with.
+    uint64_t get_max_block_length(Span<const uint8_t> block) const
+    {
+        uint8_t type = block[0] & ~BLOCK_FLAG_RESET;
+        Span<const uint8_t> payload = block.subspan(1, block.length - 1);
+
+        if (type == BLOCK_TYPE_STORED)
+            return payload.length;
+
+        if (type == BLOCK_TYPE_LZSS)
+            return this->get_max_decoded_length(payload.length);
+
+        if (type == BLOCK_TYPE_LZSS_SPLIT && payload.length >= 2 && payload[0] >= 1 && payload[0] <= 31 && payload[1] >= 1 && payload[1] <= 31)
+            return this->with_split(payload[0], payload[1]).get_max_decoded_length(payload.length - 2);
+
+        if (type == BLOCK_TYPE_HUFFMAN && payload.length >= 4)
+            return _load_uint32_le(payload.data);
+
+        throw std::invalid_argument("frame");
+    }
+
+    // Checks a frame's header, footer and block index against this codec and the decode limit, so the
+    // original length it returns is one the blocks can actually fill: the blocks have to cover the payload
+    // exactly, and none may claim more than the block size or than its bytes can decode to.
+    frame_info_t open_frame(Span<const uint8_t> input) const
+    {
+        frame_info_t frame = read_frame_info(input);
+
+        if (frame.offset_bits != this->offset_bits || frame.length_bits != this->length_bits || frame.minimum_length != this->minimum_length ||
+            (frame.flags & FORMAT_FLAGS) != this->format)
+            throw std::invalid_argument("frame");
+
+        if (frame.original_length > this->decode_limit || frame.original_length > (uint64_t)frame.block_count * frame.block_size)
+            throw std::length_error("frame");
+
+        uint32_t entry_size = get_frame_index_entry_size(frame.flags);
+        uint64_t position = FRAME_HEADER_SIZE, decoded = 0;
+
+        for (uint32_t block = 0; block < frame.block_count; block += 1)
+        {
+            const uint8_t *entry = &input[frame.index_position + (uint64_t)block * entry_size];
+            uint32_t stored_size = _load_uint32_le(entry), original_size = _load_uint32_le(entry + 4);
+
+            if (stored_size == 0 || stored_size > frame.index_position - position)
+                throw std::out_of_range("frame");
+
+            if (original_size > frame.block_size || original_size > this->get_max_block_length(input.subspan(position, stored_size)))
+                throw std::length_error("frame");
+
+            position += stored_size;
+            decoded += original_size;
+        }
+
+        if (position != frame.index_position || decoded != frame.original_length)
+            throw std::invalid_argument("frame");
+
+        return frame;
+    }
+
+    // Reads an indexed frame's block index into where each block starts in the frame and in the output,
+    // with one more entry for where the last one ends, and with FRAME_FLAG_CHECKSUMS each block's checksum.
+    void read_frame_index(Span<const uint8_t> input, const frame_info_t &frame, std::vector<uint64_t> &input_offsets, std::vector<uint64_t> &output_offsets,
+                          std::vector<uint32_t> &checksums) const
+    {
+        input_offsets.assign(frame.block_count + 1, FRAME_HEADER_SIZE);
+        output_offsets.assign(frame.block_count + 1, 0);
+        checksums.assign((frame.flags & FRAME_FLAG_CHECKSUMS) ? frame.block_count : 0, 0);
+
+        uint32_t entry_size = get_frame_index_entry_size(frame.flags);
+
+        for (uint32_t block = 0; block < frame.block_count; block += 1)
+        {
+            const uint8_t *entry = &input[frame.index_position + (uint64_t)block * entry_size];
+
+            input_offsets[block + 1] = input_offsets[block] + _load_uint32_le(entry);
+            output_offsets[block + 1] = output_offsets[block] + _load_uint32_le(entry + 4);
+
+            if (!checksums.empty())
+                checksums[block] = _load_uint32_le(entry + FRAME_INDEX_ENTRY_SIZE);
+
+            if (input_offsets[block + 1] <= input_offsets[block] || input_offsets[block + 1] > frame.index_position)
+                throw std::out_of_range("frame");
+        }
+
+        if (output_offsets[frame.block_count] != frame.original_length)
+            throw std::invalid_argument("frame");
+    }
+
+    // Decodes one block of an indexed frame, type byte first, into the `original_size` bytes at `output`.
+    // Matches may reach `history` bytes back before it; `has_slack` works as for `decode_tokens`.
+    void decode_block(Span<const uint8_t> block, uint8_t *output, uint32_t original_size, uint64_t history, bool has_slack) const
+    {
+        uint8_t type = block[0] & ~BLOCK_FLAG_RESET;
+        Span<const uint8_t> payload = block.subspan(1, block.length - 1);
+
+        if (type == BLOCK_TYPE_HUFFMAN)
+        {
+            this->decode_entropy_block(payload, output, original_size, history, has_slack);
+            return;
+        }
+
+        if (type == BLOCK_TYPE_STORED)
+        {
+            if (payload.length != original_size)
+                throw std::invalid_argument("frame");
+
+            memcpy(output, payload.data, original_size);
+            return;
+        }
+
+        if (type == BLOCK_TYPE_LZSS_SPLIT)
+        {
+            if (payload.length < 2 || payload[0] < 1 || payload[0] > 31 || payload[1] < 1 || payload[1] > 31)
+                throw std::invalid_argument("frame");
+
+            LzssCodec<DynamicLayout> codec = this->with_split(payload[0], payload[1]);
+            BitStream64 stream(payload.subspan(2, payload.length - 2));
+
+            if (stream.read_7bit_uint32() != original_size)
+                throw std::invalid_argument("frame");
+
+            codec.decode_tokens(stream, output, original_size, history, has_slack);
+            return;
+        }
+
+        if (type != BLOCK_TYPE_LZSS)
+            throw std::invalid_argument("frame");
+
+        BitStream64 stream(payload);
+
+        if (stream.read_7bit_uint32() != original_size)
+            throw std::invalid_argument("frame");
+
+        this->decode_tokens(stream, output, original_size, history, has_slack);
+    }
+
+public:
+    LzssCodec(const Layout &layout = Layout(), int level = DEFAULT_LEVEL) : LzssCodec(layout, get_level(level)) {}
+
+    LzssCodec(const Layout &layout, const level_t &level) : Layout(layout)
+    {
+        this->level = level;
+        this->decode_limit = DEFAULT_DECODE_LIMIT;
+        this->format = 0;
+    }
+
+    uint8_t get_offset_bits() const { return this->offset_bits; }
+    uint8_t get_length_bits() const { return this->length_bits; }
+    uint32_t get_minimum_length() const { return this->minimum_length; }
+    uint32_t get_max_offset() const { return this->max_offset; }
+
+    // Caps the original length every decode accepts, whatever a stream's or frame's header claims: larger
+    // ones throw std::length_error before anything is allocated. For input from untrusted sources, set it
+    // to the largest message expected. It can't be raised above DEFAULT_DECODE_LIMIT.
+    void set_decode_limit(uint64_t limit) { this->decode_limit = MIN(limit, DEFAULT_DECODE_LIMIT); }
+    uint64_t get_decode_limit() const { return this->decode_limit; }
+
+    // Selects token format options, FORMAT_ flags or 0 for the plain format `Lzss` has always written.
+    // They change the stream itself: a raw stream only decodes with the format it was encoded with, frames
+    // record it and only decode with a codec set to the same.
+    void set_format(uint8_t format)
+    {
+        if (format & ~FORMAT_FLAGS)
+            throw std::invalid_argument("format");
+
+        this->format = format;
+    }
+
+    uint8_t get_format() const { return this->format; }
+
+    uint64_t get_upper_bound(uint64_t input_length) const
+    {
+        // We sum all bits in the worst case scenario: 32 for the total input length and input_lenght * 9 (literal flag + byte)
+        uint64_t total_bits = 32 + input_length * 9;
+
+        // With a small `minimum_length` a pair can cost more than the literals it replaces.
+        uint32_t pair_bits = this->get_pair_bits();
+        uint32_t pair_bytes = MAX(this->minimum_length, 1);
+
+        if (pair_bits > 9 * pair_bytes)
+            total_bits = 32 + (input_length * pair_bits + pair_bytes - 1) / pair_bytes;
+
+        // If it's divisible by 8, we return the length. If not we sum 1 to account for the extra bits.
+        return (total_bits / 8) + ((total_bits % 8 > 0) ? 1 : 0);
+    }
+
+    // Most bytes `input_length` bytes of tokens can decode to: every token a maximum length pair, or as
+    // many of the shortest token as fit if that is a literal. With FORMAT_EXTENDED_LENGTHS a single pair
+    // can cover any 32-bit length, so only the decode limit bounds what a stream claims.
+    uint64_t get_max_decoded_length(uint64_t input_length) const
+    {
+        uint64_t tokens = input_length * 8 / this->get_shortest_token_bits();
+        uint64_t longest = (this->format & FORMAT_EXTENDED_LENGTHS) ? 0xFFFFFFFF : MAX(this->maximum_length, 1);
+
+        return tokens > 0xFFFFFFFFFFFFFFFF / longest ? 0xFFFFFFFFFFFFFFFF : tokens * longest;
+    }
+
+    // Writes the tokens for `input[start..]` to a BitStream64, or buffers them in a SequenceBuffer. Matches may
+    // reach back into the `start` bytes before it, which the decoder has to hold as history when it decodes this block.
+    template <typename Sink>
+    void encode_tokens(Span<const uint8_t> input, uint32_t start, Sink &stream) const
+    {
+        if (this->level.match_finder == MATCH_FINDER_BINARY_TREE)
+        {
+            BinaryTree tree(this->offset_bits, this->minimum_length, this->maximum_length, this->level.chain_depth);
+            this->encode_tokens(input, start, stream, tree);
+        }
+        else
+        {
+            HashChain chain(this->offset_bits, this->minimum_length);
+            this->encode_tokens(input, start, stream, chain);
+        }
+    }
+
+    // Same, reusing a HashChain or BinaryTree from an earlier call.
+    template <typename Sink, typename Finder>
+    void encode_tokens(Span<const uint8_t> input, uint32_t start, Sink &stream, Finder &chain) const
+    {
+        chain.reset(input.length);
+
+        for (uint32_t index = (start > this->max_offset) ? start - this->max_offset : 0; index < start; index += 1)
+            chain.insert(input, index);
+
+        if (this->level.optimal)
+            this->encode_optimal(input, start, stream, chain);
+        else
+            this->encode_lazy(input, start, stream, chain);
+    }
+
+    // Decodes `length` bytes of tokens into `output`. Matches may reach back into the `history` bytes before
+    // `output`, which the caller has already placed there; one reaching further throws, as does one running
+    // past `length`. Without `has_slack` (MATCH_COPY_SLACK writable bytes past the end) the fast loop stops
+    // early enough that its wide copies never leave `output`.
+    void decode_tokens(BitStream64 &stream, uint8_t *output, uint32_t length, uint64_t history, bool has_slack) const
+    {
+        // Fast loop: while a whole word of input is left and even the longest match a length field holds fits
+        // in the output, every token is decoded from one unchecked peek with no bounds checks on either side.
+        // The peek has 57 usable bits, so configurations with wider pairs always take the checked loop.
+        uint32_t margin = MAX(this->get_longest_plain_length(), 1) + (has_slack ? 0 : MATCH_COPY_SLACK);
+        uint32_t fast_end = (this->get_pair_bits() <= 57 && length > margin) ? length - margin : 0;
+        uint64_t capacity = (uint64_t)length + (has_slack ? MATCH_COPY_SLACK : 0);
+
+        LZSS_STAT(StatsTimer timer(lzss_stats().decode_ns);)
+
+        uint32_t checked_end = history >= this->max_offset ? 0 : MIN(fast_end, this->max_offset - (uint32_t)history);
+
+        RepCache reps;
+        uint32_t index = 0;
+
+        switch (this->format)
+        {
+        case FORMAT_REP_MATCHES:
+            index = this->template decode_tokens_fast<FORMAT_REP_MATCHES>(stream, output, checked_end, fast_end, length, capacity, history, reps);
+            break;
+        case FORMAT_EXTENDED_LENGTHS:
+            index = this->template decode_tokens_fast<FORMAT_EXTENDED_LENGTHS>(stream, output, checked_end, fast_end, length, capacity, history, reps);
+            break;
+        case FORMAT_REP_MATCHES | FORMAT_EXTENDED_LENGTHS:
+            index = this->template decode_tokens_fast<FORMAT_REP_MATCHES | FORMAT_EXTENDED_LENGTHS>(stream, output, checked_end, fast_end, length, capacity, history, reps);
+            break;
+        default:
+            index = this->template decode_tokens_fast<0>(stream, output, checked_end, fast_end, length, capacity, history, reps);
+            break;
+        }
+
+        while (index < length)
+        {
+            bool is_pair = stream.read_bit();
+            if (is_pair)
+            {
+                uint32_t offset;
+                uint64_t match_length;
+
+                if ((this->format & FORMAT_REP_MATCHES) && stream.read_bit())
+                {
+                    offset = reps.use(stream.read_uint32(REP_SLOT_BITS));
+                    match_length = this->read_length(stream, stream.read_uint32(this->length_bits));
+                }
+                else
+                {
+                    offset = stream.read_uint32(this->offset_bits);
+                    match_length = this->read_length(stream, stream.read_uint32(this->length_bits));
+
+                    if (this->format & FORMAT_REP_MATCHES)
+                        reps.push(offset);
+                }
+
+                if (offset == 0 || offset > index + history || match_length > length - index)
+                    throw std::invalid_argument("stream");
+
+                _copy_match_within(output + index, offset, match_length, capacity - index);
+                index += match_length;
+
+                LZSS_STAT(lzss_stats().pairs_decoded += 1;)
+            }
+            else
+            {
+                auto literal = stream.read_uint32(8);
+                output[index] = literal & 0xFF;
+                index += 1;
+
+                LZSS_STAT(lzss_stats().literals_decoded += 1;)
+            }
+        }
+    }
+
+    // Writes the raw stream for `input` into `output` and returns its size. `output` needs room for
+    // `get_upper_bound(input.length)` bytes in the worst case; a smaller one throws std::out_of_range if it fills up.
+    size_t encode(Span<const uint8_t> input, Span<uint8_t> output) const
+    {
+        // The 7-bit VLQ header holds 32 bits, larger inputs have to go through `encode_frame`.
+        if (input.length > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        BitStream64 stream(output);
+
+        stream.write_7bit_uint32(input.length);
+        this->encode_tokens(input, 0, stream);
+
+        stream.flush();
+
+        return stream.buffer_position;
+    }
+
+    // The Array-returning overloads take their output buffer from `allocator`, the heap if it is NULL.
+    Array<uint8_t> encode(Span<const uint8_t> input, Allocator *allocator = NULL) const
+    {
+        // Array lengths are 32-bit, larger outputs have to be encoded into a caller-provided buffer.
+        if (get_upper_bound(input.length) > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        Array<uint8_t> output(get_upper_bound(input.length), allocator);
+        output.length = this->encode(input, output);
+
+        return output;
+    }
+
+    // Encodes into `context`'s output buffer. The result stays valid until the next call with the same context.
+    Span<const uint8_t> encode(Span<const uint8_t> input, LzssContext &context) const
+    {
+        if (input.length > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        if (context.dictionary != NULL)
+        {
+            Span<uint8_t> output = context.reserve_output(DICTIONARY_HEADER_SIZE + get_upper_bound(input.length));
+            size_t size = 0;
+
+            this->with_finder(context, [&](auto &finder)
+            {
+                size = this->encode_dictionary(input, output, *context.dictionary, finder, context.window);
+            });
+
+            return Span<const uint8_t>(output.data, size);
+        }
+
+        Span<uint8_t> output = context.reserve_output(get_upper_bound(input.length));
+        size_t size = 0;
+
+        this->with_finder(context, [&](auto &finder)
+        {
+            size = this->encode_raw(input, output, finder);
+        });
+
+        return Span<const uint8_t>(output.data, size);
+    }
+
+    // The size `decode` writes for `input`, read from a raw or dictionary stream's length header or from a frame's
+    // footer, with the same checks, so a caller can size the buffer it decodes into up front. Streamed frames
+    // don't record it and throw std::invalid_argument.
+    uint64_t get_decoded_size(Span<const uint8_t> input) const
+    {
+        if (is_frame(input))
+        {
+            if (input[5] & FRAME_FLAG_STREAMED)
+                throw std::invalid_argument("frame");
+
+            return this->open_frame(input).original_length;
+        }
+
+        if (is_dictionary_stream(input))
+            input = input.subspan(DICTIONARY_HEADER_SIZE, input.length - DICTIONARY_HEADER_SIZE);
+
+        BitStream64 stream(input);
+        return this->read_original_length(input, stream);
+    }
+
+    // Decodes a raw stream, a frame or a streamed frame into `output` and returns the decoded size.
+    // Throws std::out_of_range if `output` is too small for it; `get_decoded_size` bytes are enough, and
+    // MATCH_COPY_SLACK more let the last matches be copied with whole-word stores.
+    size_t decode(Span<const uint8_t> input, Span<uint8_t> output) const
+    {
+        if (is_frame(input))
+            return (input[5] & FRAME_FLAG_STREAMED) ? this->decode_stream(input, output) : this->decode_frame(input, output);
+
+        if (is_dictionary_stream(input))
+            throw std::invalid_argument("dictionary");
+
+        return this->decode_raw(input, output);
+    }
+
+    // Decodes a raw stream, or a frame written by `encode_frame`.
+    Array<uint8_t> decode(Span<const uint8_t> input, Allocator *allocator = NULL) const
+    {
+        if (is_frame(input))
+            return (input[5] & FRAME_FLAG_STREAMED) ? this->decode_stream(input, allocator) : this->decode_frame(input, NULL, allocator);
+
+        if (is_dictionary_stream(input))
+            throw std::invalid_argument("dictionary");
+
+        BitStream64 stream(input);
+        uint32_t original_length = this->read_original_length(input, stream);
+        Array<uint8_t> output(original_length + MATCH_COPY_SLACK, allocator);
+        output.length = original_length;
+
+        this->decode_tokens(stream, output.get_buffer(), original_length, 0, true);
+
+        return output;
+    }
+
+    // Decodes into `context`'s output buffer. The result stays valid until the next call with the same context.
+    Span<const uint8_t> decode(Span<const uint8_t> input, LzssContext &context) const
+    {
+        uint64_t original_length;
+
+        if (is_dictionary_stream(input))
+        {
+            Span<const uint8_t> tokens = open_dictionary_stream(input, context.dictionary);
+            BitStream64 stream(tokens);
+            original_length = this->read_original_length(tokens, stream);
+
+            // Decoded right behind a copy of the history, which the matches reach back into.
+            Span<const uint8_t> history = context.dictionary->get_history(this->max_offset);
+            this->check_dictionary_window(history, (uint32_t)original_length);
+
+            Span<uint8_t> output = context.reserve_output(history.length + original_length + MATCH_COPY_SLACK);
+
+            if (history.length > 0)
+                memcpy(output.data, history.data, history.length);
+            this->decode_tokens(stream, output.data + history.length, original_length, history.length, true);
+
+            return Span<const uint8_t>(output.data + history.length, original_length);
+        }
+
+        if (!is_frame(input))
+        {
+            BitStream64 stream(input);
+            original_length = this->read_original_length(input, stream);
+        }
+        else if (!(input[5] & FRAME_FLAG_STREAMED))
+            original_length = this->open_frame(input).original_length;
+        else
+        {
+            // Streamed frames don't record their size up front.
+            Array<uint8_t> decoded = this->decode_stream(input, context.allocator);
+
+            if (decoded.length > context.output.length)
+                context.output = std::move(decoded);
+            else if (decoded.length > 0)
+                memcpy(context.output.get_buffer(), decoded.get_buffer(), decoded.length);
+
+            return Span<const uint8_t>(context.output.get_buffer(), decoded.length);
+        }
+
+        Span<uint8_t> output = context.reserve_output(original_length + MATCH_COPY_SLACK);
+
+        return Span<const uint8_t>(output.data, this->decode(input, output));
+    }
+
+    // Encodes against a preset dictionary into a dictionary stream (see DICTIONARY_MAGIC), which only
+    // `decode` with the same dictionary can read. `output` needs DICTIONARY_HEADER_SIZE more than `get_upper_bound`.
+    size_t encode(Span<const uint8_t> input, Span<uint8_t> output, const LzssDictionary &dictionary) const
+    {
+        std::vector<uint8_t> window;
+
+        if (this->level.match_finder == MATCH_FINDER_BINARY_TREE)
+        {
+            BinaryTree tree(this->offset_bits, this->minimum_length, this->maximum_length, this->level.chain_depth);
+            return this->encode_dictionary(input, output, dictionary, tree, window);
+        }
+
+        HashChain chain(this->offset_bits, this->minimum_length);
+        return this->encode_dictionary(input, output, dictionary, chain, window);
+    }
+
+    Array<uint8_t> encode(Span<const uint8_t> input, const LzssDictionary &dictionary, Allocator *allocator = NULL) const
+    {
+        uint64_t bound = DICTIONARY_HEADER_SIZE + get_upper_bound(input.length);
+
+        if (bound > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        Array<uint8_t> output(bound, allocator);
+        output.length = this->encode(input, output, dictionary);
+
+        return output;
+    }
+
+    // Decodes a dictionary stream encoded against `dictionary`. Anything else is decoded as without one.
+    size_t decode(Span<const uint8_t> input, Span<uint8_t> output, const LzssDictionary &dictionary) const
+    {
+        if (!is_dictionary_stream(input))
+            return this->decode(input, output);
+
+        Span<const uint8_t> tokens = open_dictionary_stream(input, &dictionary);
+        BitStream64 stream(tokens);
+        uint32_t original_length = this->read_original_length(tokens, stream);
+
+        if (original_length > output.length)
+            throw std::out_of_range("output");
+
+        // Matches reach back into the history, so it has to sit right before the output.
+        Span<const uint8_t> history = dictionary.get_history(this->max_offset);
+        this->check_dictionary_window(history, original_length);
+
+        std::vector<uint8_t> window(history.length + original_length + MATCH_COPY_SLACK);
+
+        std::copy(history.data, history.data + history.length, window.begin());
+        this->decode_tokens(stream, window.data() + history.length, original_length, history.length, true);
+        std::copy(window.begin() + history.length, window.begin() + history.length + original_length, output.data);
+
+        return original_length;
+    }
+
+    Array<uint8_t> decode(Span<const uint8_t> input, const LzssDictionary &dictionary, Allocator *allocator = NULL) const
+    {
+        if (!is_dictionary_stream(input))
+            return this->decode(input, allocator);
+
+        Span<const uint8_t> tokens = open_dictionary_stream(input, &dictionary);
+        BitStream64 stream(tokens);
+        uint32_t original_length = this->read_original_length(tokens, stream);
+
+        Span<const uint8_t> history = dictionary.get_history(this->max_offset);
+        this->check_dictionary_window(history, original_length);
+
+        Array<uint8_t> output(history.length + original_length + MATCH_COPY_SLACK, allocator);
+
+        if (history.length > 0)
+            memcpy(output.get_buffer(), history.data, history.length);
+        this->decode_tokens(stream, output.get_buffer() + history.length, original_length, history.length, true);
+
+        memmove(output.get_buffer(), output.get_buffer() + history.length, original_length);
+        output.length = original_length;
+
+        return output;
+    }
+
+    // Worst-case size of `encode_batch` output for `inputs`.
+    uint64_t get_batch_upper_bound(Span<const Span<const uint8_t>> inputs) const
+    {
+        uint64_t bound = BATCH_PREFIX_SIZE;
+
+        for (size_t record = 0; record < inputs.length; record += 1)
+            bound += BATCH_PREFIX_SIZE + get_upper_bound(inputs[record].length);
+
+        return bound;
+    }
+
+    // Encodes every input as a message of its own into one batch (see BATCH_PREFIX_SIZE) and returns its size.
+    // Chunks of records are encoded across `pool`, or one made for the call if NULL, each worker reusing one
+    // set of match finder tables, so small records cost neither an allocation nor a table clear apiece.
+    // `output` needs `get_batch_upper_bound(inputs)` bytes.
+    size_t encode_batch(Span<const Span<const uint8_t>> inputs, Span<uint8_t> output, ThreadPool *pool = NULL) const
+    {
+        if (inputs.length > 0xFFFFFFFF)
+            throw std::length_error("inputs");
+
+        if (output.length < this->get_batch_upper_bound(inputs))
+            throw std::out_of_range("output");
+
+        uint32_t count = inputs.length;
+        std::vector<uint32_t> chunks = get_batch_chunks(count, [&](uint32_t record) { return inputs[record].length; });
+        uint32_t chunk_count = chunks.size() - 1;
+
+        // Like frame blocks, every chunk gets a slot big enough for its worst case, then the slots are packed together.
+        std::vector<uint64_t> slots(chunk_count + 1, BATCH_PREFIX_SIZE);
+        for (uint32_t chunk = 0; chunk < chunk_count; chunk += 1)
+        {
+            slots[chunk + 1] = slots[chunk];
+            for (uint32_t record = chunks[chunk]; record < chunks[chunk + 1]; record += 1)
+                slots[chunk + 1] += BATCH_PREFIX_SIZE + get_upper_bound(inputs[record].length);
+        }
+
+        std::vector<uint64_t> stored_sizes(chunk_count);
+
+        // Contexts go back here after a chunk, so there are never more than the pool has threads.
+        std::vector<std::unique_ptr<LzssContext>> contexts;
+        std::mutex contexts_mutex;
+
+        for_batch_chunks(pool, chunk_count, [&](uint32_t chunk)
+        {
+            std::unique_ptr<LzssContext> context;
+            {
+                std::lock_guard<std::mutex> lock(contexts_mutex);
+                if (!contexts.empty())
+                {
+                    context = std::move(contexts.back());
+                    contexts.pop_back();
+                }
+            }
+
+            if (!context)
+                context.reset(new LzssContext());
+
+            uint64_t position = slots[chunk];
+
+            this->with_finder(*context, [&](auto &finder)
+            {
+                for (uint32_t record = chunks[chunk]; record < chunks[chunk + 1]; record += 1)
+                {
+                    Span<const uint8_t> input = inputs[record];
+
+                    if (input.length > 0xFFFFFFFF)
+                        throw std::length_error("input");
+
+                    // Encoded behind room for the longest prefix, then moved up against the prefix it got.
+                    Span<uint8_t> room = output.subspan(position + BATCH_PREFIX_SIZE, slots[chunk + 1] - position - BATCH_PREFIX_SIZE);
+                    size_t size = this->encode_raw(input, room, finder);
+
+                    uint32_t prefix = _store_7bit_uint32(&output[position], size);
+                    memmove(&output[position + prefix], room.data, size);
+
+                    position += prefix + size;
+                }
+            });
+
+            stored_sizes[chunk] = position - slots[chunk];
+
+            std::lock_guard<std::mutex> lock(contexts_mutex);
+            contexts.push_back(std::move(context));
+        });
+
+        return pack_slots(output.data, _store_7bit_uint32(output.data, count), slots, stored_sizes);
+    }
+
+    Array<uint8_t> encode_batch(Span<const Span<const uint8_t>> inputs, ThreadPool *pool = NULL, Allocator *allocator = NULL) const
+    {
+        uint64_t bound = this->get_batch_upper_bound(inputs);
+
+        if (bound > 0xFFFFFFFF)
+            throw std::length_error("inputs");
+
+        Array<uint8_t> output(bound, allocator);
+        output.length = this->encode_batch(inputs, output, pool);
+
+        return output;
+    }
+
+    // The raw streams of a batch's records, in order, each one something `decode` or `get_decoded_size` takes.
+    static std::vector<Span<const uint8_t>> split_batch(Span<const uint8_t> input)
+    {
+        uint64_t position = 0;
+        uint32_t count = _load_7bit_uint32(input, position);
+
+        // Every record takes at least its one byte prefix, which bounds what a forged count can allocate.
+        if (count > input.length - position)
+            throw std::out_of_range("batch");
+
+        std::vector<Span<const uint8_t>> records(count);
+
+        for (uint32_t record = 0; record < count; record += 1)
+        {
+            uint32_t size = _load_7bit_uint32(input, position);
+
+            if (size > input.length - position)
+                throw std::out_of_range("batch");
+
+            records[record] = input.subspan(position, size);
+            position += size;
+        }
+
+        if (position != input.length)
+            throw std::invalid_argument("batch");
+
+        return records;
+    }
+
+    // Decodes every record of a batch into the output at the same index, across `pool` like `encode_batch`,
+    // and shrinks each output to the size decoded into it. Throws std::invalid_argument unless there is exactly
+    // one output per record, and std::out_of_range if a record doesn't fit its output.
+    void decode_batch(Span<const uint8_t> input, Span<Span<uint8_t>> outputs, ThreadPool *pool = NULL) const
+    {
+        std::vector<Span<const uint8_t>> records = split_batch(input);
+
+        if (records.size() != outputs.length)
+            throw std::invalid_argument("outputs");
+
+        std::vector<uint32_t> chunks = get_batch_chunks(records.size(), [&](uint32_t record) { return records[record].length; });
+
+        for_batch_chunks(pool, chunks.size() - 1, [&](uint32_t chunk)
+        {
+            for (uint32_t record = chunks[chunk]; record < chunks[chunk + 1]; record += 1)
+                outputs[record].length = this->decode_raw(records[record], outputs[record]);
+        });
+    }
+
+    // Worst-case size of `encode_frame` output for `input_length` bytes.
+    uint64_t get_frame_upper_bound(uint64_t input_length, uint32_t block_size) const
+    {
+        uint64_t block_count = (input_length + block_size - 1) / block_size;
+        uint64_t full_blocks = input_length / block_size;
+        uint32_t last_block = input_length % block_size;
+
+        // Room for checksums either way, they are only a few bytes per block.
+        uint64_t bound = FRAME_HEADER_SIZE + block_count * (1 + FRAME_INDEX_ENTRY_SIZE + CHECKSUM_SIZE) + CHECKSUM_SIZE + FRAME_FOOTER_SIZE;
+        bound += full_blocks * get_upper_bound(block_size);
+
+        return last_block > 0 ? bound + get_upper_bound(last_block) : bound;
+    }
+
+    // Splits `input` into `options.block_size` blocks, compresses them in parallel and writes them as one
+    // frame (see FRAME_MAGIC) into `output`, which needs `get_frame_upper_bound` bytes. Returns the frame's size.
+    // Every block is a complete raw stream, so it can be decoded on its own unless `options.linked`
+    // let it reference the previous block's last `max_offset` bytes, which `options.seek_interval` limits
+    // to the blocks since the last seek point.
+    size_t encode_frame(Span<const uint8_t> input, Span<uint8_t> output, frame_options_t options = frame_options_t()) const
+    {
+        if (options.block_size == 0)
+            throw std::invalid_argument("block_size");
+
+        if (output.length < this->get_frame_upper_bound(input.length, options.block_size))
+            throw std::out_of_range("output");
+
+        uint64_t block_count = (input.length + options.block_size - 1) / options.block_size;
+        if (block_count > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        auto block_length = [&](uint32_t block) -> uint32_t
+        {
+            return MIN((uint64_t)options.block_size, input.length - (uint64_t)block * options.block_size);
+        };
+
+        // Every block gets a slot big enough for its worst case, then the slots are packed together.
+        std::vector<uint64_t> slots(block_count + 1, FRAME_HEADER_SIZE);
+        for (uint32_t block = 0; block < block_count; block += 1)
+            slots[block + 1] = slots[block] + 1 + get_upper_bound(block_length(block));
+
+        std::vector<uint32_t> stored_sizes(block_count);
+        std::vector<uint32_t> checksums(options.checksums ? block_count : 0);
+
+        ThreadPool local_pool(options.pool == NULL ? options.threads : 1);
+        ThreadPool &pool = (options.pool == NULL) ? local_pool : *options.pool;
+
+        pool.parallel_for(block_count, [&](uint32_t block)
+        {
+            uint64_t start = (uint64_t)block * options.block_size;
+            uint32_t length = block_length(block);
+
+            // Blocks of a linked frame reach back to the last one that started over.
+            bool reset = options.linked && options.seek_interval > 0 && block % options.seek_interval == 0;
+            uint64_t chain_start = options.seek_interval > 0 ? (uint64_t)(block - block % options.seek_interval) * options.block_size : 0;
+            uint32_t history = options.linked ? MIN(start - chain_start, (uint64_t)this->max_offset) : 0;
+
+            Span<uint8_t> slot = output.subspan(slots[block], slots[block + 1] - slots[block]);
+            Span<const uint8_t> window = input.subspan(start - history, history + length);
+
+            size_t size = 0;
+
+            if (!options.skip_incompressible || !looks_incompressible(input.subspan(start, length)))
+            {
+                std::pair<uint8_t, uint8_t> split(this->offset_bits, this->length_bits);
+                if (options.adaptive)
+                    split = this->choose_split(window, history);
+
+                if (split.first != this->offset_bits || split.second != this->length_bits)
+                {
+                    LzssCodec<DynamicLayout> codec = this->with_split(split.first, split.second);
+
+                    // Other widths have another worst case, so the block only goes into its slot if it fits.
+                    std::vector<uint8_t> scratch(3 + codec.get_upper_bound(length));
+                    size = codec.encode_block(window, history, Span<uint8_t>(scratch.data(), scratch.size()), options.entropy, true);
+
+                    if (size <= slot.length)
+                        memcpy(slot.data, scratch.data(), size);
+                    else
+                        size = 0;
+                }
+
+                if (size == 0)
+                    size = this->encode_block(window, history, slot, options.entropy, false);
+            }
+
+            if (size == 0 || size > 1 + (size_t)length)
+            {
+                slot[0] = BLOCK_TYPE_STORED;
+                memcpy(&slot[1], &input[start], length);
+                size = 1 + length;
+            }
+
+            if (reset)
+                slot[0] |= BLOCK_FLAG_RESET;
+
+            if (options.checksums)
+                checksums[block] = crc32c(0, &input[start], length);
+
+            stored_sizes[block] = size;
+        });
+
+        uint8_t *bytes = output.data;
+        uint64_t position = FRAME_HEADER_SIZE;
+
+        uint8_t flags = (options.linked ? FRAME_FLAG_LINKED : 0) | (options.checksums ? FRAME_FLAG_CHECKSUMS : 0) | this->format;
+        write_frame_header(bytes, flags, this->offset_bits, this->length_bits, this->minimum_length, options.block_size);
+
+        position = pack_slots(bytes, position, slots, stored_sizes);
+
+        uint32_t content_checksum = 0;
+
+        for (uint32_t block = 0; block < block_count; block += 1)
+        {
+            _store_uint32_le(bytes + position, stored_sizes[block]);
+            _store_uint32_le(bytes + position + 4, block_length(block));
+            position += FRAME_INDEX_ENTRY_SIZE;
+
+            if (options.checksums)
+            {
+                _store_uint32_le(bytes + position, checksums[block]);
+                position += CHECKSUM_SIZE;
+
+                content_checksum = crc32c_combine(content_checksum, checksums[block], block_length(block));
+            }
+        }
+
+        if (options.checksums)
+        {
+            _store_uint32_le(bytes + position, content_checksum);
+            position += CHECKSUM_SIZE;
+        }
+
+        _store_uint32_le(bytes + position, block_count);
+        _store_uint64_le(bytes + position + 4, input.length);
+        memcpy(bytes + position + 12, FRAME_MAGIC, 4);
+
+        return position + FRAME_FOOTER_SIZE;
+    }
+
+    Array<uint8_t> encode_frame(Span<const uint8_t> input, frame_options_t options = frame_options_t(), Allocator *allocator = NULL) const
+    {
+        uint64_t bound = this->get_frame_upper_bound(input.length, options.block_size == 0 ? 1 : options.block_size);
+
+        // Array lengths are 32-bit, larger frames have to be encoded into a caller-provided buffer.
+        if (bound > 0xFFFFFFFF)
+            throw std::length_error("input");
+
+        Array<uint8_t> output(bound, allocator);
+        output.length = this->encode_frame(input, output, options);
+
+        return output;
+    }
+
+    // Decodes a frame straight into `output`, which needs the frame's original length, and returns that length.
+    // The index gives every block's input and output offset, so independent blocks are decoded in parallel,
+    // each worker writing its final slice in place. Linked blocks need the previous block's output as history
+    // and are decoded in order.
+    size_t decode_frame(Span<const uint8_t> input, Span<uint8_t> output, ThreadPool *pool = NULL) const
+    {
+        frame_info_t frame = this->open_frame(input);
+
+        if (frame.original_length > output.length)
+            throw std::out_of_range("output");
+
+        std::vector<uint64_t> input_offsets, output_offsets;
+        std::vector<uint32_t> checksums;
+        this->read_frame_index(input, frame, input_offsets, output_offsets, checksums);
+
+        bool has_slack = output.length - frame.original_length >= MATCH_COPY_SLACK;
+
+        auto decode_at = [&](uint32_t block, uint64_t history)
+        {
+            uint64_t position = input_offsets[block];
+            uint32_t original_size = output_offsets[block + 1] - output_offsets[block];
+
+            // Only the last block may overrun into the slack; any other would race with its neighbour's worker.
+            bool block_slack = has_slack && block + 1 == frame.block_count;
+
+            this->decode_block(input.subspan(position, input_offsets[block + 1] - position), &output[output_offsets[block]], original_size, history, block_slack);
+
+            // Checked right away, while the block is still in this worker's cache.
+            if (!checksums.empty())
+                verify_checksum(&output[output_offsets[block]], original_size, checksums[block]);
+        };
+
+        if (frame.flags & FRAME_FLAG_LINKED)
+        {
+            uint64_t chain_start = 0;
+
+            for (uint32_t block = 0; block < frame.block_count; block += 1)
+            {
+                if (input[input_offsets[block]] & BLOCK_FLAG_RESET)
+                    chain_start = output_offsets[block];
+
+                decode_at(block, output_offsets[block] - chain_start);
+            }
+        }
+        else
+        {
+            ThreadPool local_pool(pool == NULL ? 0 : 1);
+            (pool == NULL ? local_pool : *pool).parallel_for(frame.block_count, [&](uint32_t block) { decode_at(block, 0); });
+        }
+
+        // Every block matched its own checksum, so the content's follows from theirs without another pass.
+        if (frame.flags & FRAME_FLAG_CHECKSUMS)
+        {
+            uint32_t content_checksum = 0;
+            for (uint32_t block = 0; block < frame.block_count; block += 1)
+                content_checksum = crc32c_combine(content_checksum, checksums[block], output_offsets[block + 1] - output_offsets[block]);
+
+            if (content_checksum != frame.checksum)
+                throw std::invalid_argument("checksum");
+        }
+
+        return frame.original_length;
+    }
+
+    Array<uint8_t> decode_frame(Span<const uint8_t> input, ThreadPool *pool = NULL, Allocator *allocator = NULL) const
+    {
+        frame_info_t frame = this->open_frame(input);
+
+        Array<uint8_t> output(frame.original_length + MATCH_COPY_SLACK, allocator);
+        output.length = this->decode_frame(input, Span<uint8_t>(output.get_buffer(), frame.original_length + MATCH_COPY_SLACK), pool);
+
+        return output;
+    }
+
+    // Decodes `output.length` bytes of a frame's original data from `offset` on, or as many as there are,
+    // and returns how many. Only the blocks holding them are decoded, found from the block index; in a linked
+    // frame so are the blocks before them back to the last one that starts over, see `seek_interval`. With
+    // FRAME_FLAG_CHECKSUMS each of those is checked against its own checksum.
+    size_t decode_range(Span<const uint8_t> input, uint64_t offset, Span<uint8_t> output) const
+    {
+        frame_info_t frame = this->open_frame(input);
+
+        if (offset >= frame.original_length || output.length == 0)
+            return 0;
+
+        std::vector<uint64_t> input_offsets, output_offsets;
+        std::vector<uint32_t> checksums;
+        this->read_frame_index(input, frame, input_offsets, output_offsets, checksums);
+
+        uint64_t count = MIN((uint64_t)output.length, frame.original_length - offset);
+
+        auto block_at = [&](uint64_t position) -> uint32_t
+        {
+            return std::upper_bound(output_offsets.begin(), output_offsets.end(), position) - output_offsets.begin() - 1;
+        };
+
+        uint32_t first = block_at(offset), last = block_at(offset + count - 1);
+        bool linked = frame.flags & FRAME_FLAG_LINKED;
+
+        uint32_t start = first;
+        while (linked && start > 0 && !(input[input_offsets[start]] & BLOCK_FLAG_RESET))
+            start -= 1;
+
+        // The blocks are decoded in order, so every one but the last may overrun into the next one's bytes.
+        std::vector<uint8_t> window(output_offsets[last + 1] - output_offsets[start] + MATCH_COPY_SLACK);
+
+        for (uint32_t block = start; block <= last; block += 1)
+        {
+            uint64_t position = input_offsets[block];
+            uint64_t decoded = output_offsets[block] - output_offsets[start];
+
+            this->decode_block(input.subspan(position, input_offsets[block + 1] - position), &window[decoded],
+                               output_offsets[block + 1] - output_offsets[block], linked ? decoded : 0, true);
+
+            if (!checksums.empty())
+                verify_checksum(&window[decoded], output_offsets[block + 1] - output_offsets[block], checksums[block]);
+        }
+
+        memcpy(output.data, &window[offset - output_offsets[start]], count);
+
+        return count;
+    }
+
+    Array<uint8_t> decode_range(Span<const uint8_t> input, uint64_t offset, uint64_t length, Allocator *allocator = NULL) const
+    {
+        frame_info_t frame = this->open_frame(input);
+        uint64_t count = offset >= frame.original_length ? 0 : MIN(length, frame.original_length - offset);
+
+        // Array lengths are 32-bit, larger ranges have to be decoded into a caller-provided buffer.
+        if (count > 0xFFFFFFFF)
+            throw std::length_error("range");
+
+        Array<uint8_t> output(count, allocator);
+        output.length = this->decode_range(input, offset, Span<uint8_t>(output.get_buffer(), count));
+
+        return output;
+    }
+
+    // Decodes a whole streamed frame written by LzssEncoder into `output` and returns the decoded size.
+    size_t decode_stream(Span<const uint8_t> input, Span<uint8_t> output) const
+    {
+        LzssDecoder<LzssCodec> decoder(*this);
+        size_t written = 0;
+
+        for (Span<const uint8_t> rest = input; !decoder.done();)
+        {
+            size_t consumed = decoder.push(rest);
+            rest = rest.subspan(consumed, rest.length - consumed);
+
+            written += decoder.pull(output.subspan(written, output.length - written));
+
+            if (!decoder.done() && consumed == 0 && (rest.length == 0 || written == output.length))
+                throw std::out_of_range(rest.length == 0 ? "stream" : "output");
+        }
+
+        return written;
+    }
+
+    Array<uint8_t> decode_stream(Span<const uint8_t> input, Allocator *allocator = NULL) const
+    {
+        LzssDecoder<LzssCodec> decoder(*this);
+        std::vector<uint8_t> decoded;
+        uint8_t chunk[1 << 16];
+
+        for (Span<const uint8_t> rest = input; !decoder.done();)
+        {
+            size_t consumed = decoder.push(rest);
+            rest = rest.subspan(consumed, rest.length - consumed);
+
+            for (size_t pulled; (pulled = decoder.pull(Span<uint8_t>(chunk, sizeof(chunk)))) > 0;)
+                decoded.insert(decoded.end(), chunk, chunk + pulled);
+
+            if (decoded.size() > this->decode_limit)
+                throw std::length_error("stream");
+
+            if (consumed == 0 && rest.length == 0 && !decoder.done())
+                throw std::out_of_range("stream");
+        }
+
+        Array<uint8_t> output(decoded.size(), allocator);
+        if (!decoded.empty())
+            memcpy(output.get_buffer(), decoded.data(), decoded.size());
+
+        return output;
+    }
+
+    // Writes one block of a streamed frame, `type (1) | payload size (4) | payload`, for the bytes of `window`
+    // after its first `history` ones, and returns its size. `output` needs STREAM_BLOCK_HEADER_SIZE more than
+    // `get_upper_bound` of the block. Blocks only depend on the input, so any number can be encoded at once.
+    // With a `checksum` the block's CRC-32C is stored there and written after the payload, CHECKSUM_SIZE more.
+    size_t encode_stream_block(Span<const uint8_t> window, uint32_t history, Span<uint8_t> output, uint32_t *checksum = NULL) const
+    {
+        Span<const uint8_t> block = window.subspan(history, window.length - history);
+        Span<uint8_t> payload = output.subspan(STREAM_BLOCK_HEADER_SIZE, output.length - STREAM_BLOCK_HEADER_SIZE);
+        size_t size = 0;
+
+        // Same as encode_frame: incompressible blocks are stored as they are, as is anything that grew.
+        if (!looks_incompressible(block))
+        {
+            BitStream64 stream(payload);
+
+            stream.write_7bit_uint32(block.length);
+            this->encode_tokens(window, history, stream);
+            stream.flush();
+
+            size = stream.buffer_position;
+        }
+
+        output[0] = BLOCK_TYPE_LZSS;
+
+        if (size == 0 || size > block.length)
+        {
+            memcpy(payload.data, block.data, block.length);
+
+            output[0] = BLOCK_TYPE_STORED;
+            size = block.length;
+        }
+
+        _store_uint32_le(&output[1], size);
+
+        if (checksum == NULL)
+            return STREAM_BLOCK_HEADER_SIZE + size;
+
+        *checksum = crc32c(0, block.data, block.length);
+        _store_uint32_le(&payload[size], *checksum);
+
+        return STREAM_BLOCK_HEADER_SIZE + size + CHECKSUM_SIZE;
+    }
+};
+
+// The original run-time configured codec.
+class Lzss : public LzssCodec<DynamicLayout>
+{
+public:
+    Lzss(uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length, int level = DEFAULT_LEVEL)
+        : LzssCodec<DynamicLayout>(DynamicLayout(offset_bits, length_bits, minimum_length), level)
+    {
+    }
+
+    Lzss(uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length, const level_t &level)
+        : LzssCodec<DynamicLayout>(DynamicLayout(offset_bits, length_bits, minimum_length), level)
+    {
+    }
+};
+
+// A codec compiled for one configuration, e.g. LzssFixed<10, 6, 2>.
+template <uint8_t OffsetBits, uint8_t LengthBits, uint8_t MinimumLength>
+using LzssFixed = LzssCodec<StaticLayout<OffsetBits, LengthBits, MinimumLength>>;
+
+// Configurations `lzss_dispatch` has a specialized codec for, as (offset_bits, length_bits, minimum_length).
+#define LZSS_FIXED_CONFIGURATIONS(X) \
+    X(10, 6, 2)                      \
+    X(11, 5, 2)                      \
+    X(12, 4, 3)                      \
+    X(13, 5, 3)                      \
+    X(16, 8, 3)
+
+// Calls `callback` with the LzssFixed instantiation for this configuration, or with a dynamic `Lzss`
+// when there is none. The callback takes the codec as `auto &` so one body serves both.
+// `level` is a compression level or a custom Lzss::level_t.
+template <typename Level, typename Callback>
+auto lzss_dispatch(uint8_t offset_bits, uint8_t length_bits, uint8_t minimum_length, const Level &level, Callback &&callback)
+{
+#define X(o, l, m)                                                          \
+    if (offset_bits == (o) && length_bits == (l) && minimum_length == (m)) \
+    {                                                                       \
+        LzssFixed<o, l, m> lzss(StaticLayout<o, l, m>(), level);           \
+        return callback(lzss);                                              \
+    }
+
+    LZSS_FIXED_CONFIGURATIONS(X)
+#undef X
+
+    Lzss lzss(offset_bits, length_bits, minimum_length, level);
+    return callback(lzss);
+}
+
+// Default block size for LzssEncoder. Blocks are linked, so this only bounds buffering, not the ratio.
+#define STREAM_BLOCK_SIZE (1 << 16)
+
+// Push/pull streaming encoder for input of unknown length. Everything pushed comes out of `pull` as one
+// streamed frame: header, size-prefixed linked blocks, end marker. The history is a window holding the
+// last `max_offset` input bytes, slid down after every block, so memory stays O(window + block size)
+// however long the stream runs. `push` takes no more input while encoded bytes are waiting to be pulled.
+template <typename Codec>
+class LzssEncoder
+{
+private:
+    const Codec &codec;
+
+    uint32_t block_size;
+
+    // The history followed by the block being filled.
+    std::vector<uint8_t> window;
+    uint32_t history_length;
+    uint32_t block_length;
+
+    // Encoded bytes, the first `pending_position` of them already pulled.
+    std::vector<uint8_t> pending;
+    size_t pending_position;
+
+    bool checksums;
+    uint32_t content_checksum;
+
+    bool finished;
+
+    void append_block()
+    {
+        this->pending.erase(this->pending.begin(), this->pending.begin() + this->pending_position);
+        this->pending_position = 0;
+
+        size_t start = this->pending.size();
+        this->pending.resize(start + STREAM_BLOCK_HEADER_SIZE + this->codec.get_upper_bound(this->block_length) + CHECKSUM_SIZE);
+
+        Span<const uint8_t> window(this->window.data(), this->history_length + this->block_length);
+        Span<uint8_t> slot(&this->pending[start], this->pending.size() - start);
+        uint32_t checksum = 0;
+
+        this->pending.resize(start + this->codec.encode_stream_block(window, this->history_length, slot, this->checksums ? &checksum : NULL));
+
+        if (this->checksums)
+            this->content_checksum = crc32c_combine(this->content_checksum, checksum, this->block_length);
+
+        uint32_t total = this->history_length + this->block_length;
+        uint32_t keep = MIN(total, this->codec.get_max_offset());
+
+        memmove(this->window.data(), this->window.data() + total - keep, keep);
+        this->history_length = keep;
+        this->block_length = 0;
+    }
+
+public:
+    // With `checksums` every block and the whole stream get a CRC-32C (see FRAME_FLAG_CHECKSUMS).
+    LzssEncoder(const Codec &codec, uint32_t block_size = STREAM_BLOCK_SIZE, bool checksums = false) : codec(codec)
+    {
+        if (block_size == 0)
+            throw std::invalid_argument("block_size");
+
+        this->block_size = block_size;
+        this->window.resize(codec.get_max_offset() + block_size);
+        this->history_length = 0;
+        this->block_length = 0;
+
+        this->pending.resize(FRAME_HEADER_SIZE);
+        this->pending_position = 0;
+        uint8_t flags = FRAME_FLAG_LINKED | FRAME_FLAG_STREAMED | (checksums ? FRAME_FLAG_CHECKSUMS : 0) | codec.get_format();
+        write_frame_header(this->pending.data(), flags, codec.get_offset_bits(), codec.get_length_bits(), codec.get_minimum_length(), block_size);
+
+        this->checksums = checksums;
+        this->content_checksum = 0;
+        this->finished = false;
+    }
+
+    // Takes as much of `input` as it can and returns how many bytes that was: all of it, unless a block
+    // was completed and its encoded bytes now have to be pulled first.
+    size_t push(Span<const uint8_t> input)
+    {
+        if (this->finished)
+            throw std::logic_error("push after finish");
+
+        size_t consumed = 0;
+
+        while (consumed < input.length && this->pending_position == this->pending.size())
+        {
+            uint32_t take = MIN(this->block_size - this->block_length, input.length - consumed);
+
+            memcpy(&this->window[this->history_length + this->block_length], input.data + consumed, take);
+            this->block_length += take;
+            consumed += take;
+
+            if (this->block_length == this->block_size)
+                this->append_block();
+        }
+
+        return consumed;
+    }
+
+    // Encodes whatever is left of the last block and closes the frame.
+    void finish()
+    {
+        if (this->finished)
+            return;
+
+        if (this->block_length > 0)
+            this->append_block();
+
+        this->pending.push_back(BLOCK_TYPE_END);
+
+        if (this->checksums)
+        {
+            this->pending.resize(this->pending.size() + CHECKSUM_SIZE);
+            _store_uint32_le(&this->pending[this->pending.size() - CHECKSUM_SIZE], this->content_checksum);
+        }
+
+        this->finished = true;
+    }
+
+    // Copies up to `output.length` encoded bytes out and returns how many, 0 once nothing is waiting.
+    size_t pull(Span<uint8_t> output)
+    {
+        size_t count = MIN(output.length, this->pending.size() - this->pending_position);
+
+        memcpy(output.data, this->pending.data() + this->pending_position, count);
+        this->pending_position += count;
+
+        return count;
+    }
+
+    // True after `finish` once every encoded byte has been pulled.
+    bool done() const
+    {
+        return this->finished && this->pending_position == this->pending.size();
+    }
+};
+
+// Push/pull decoder for the streamed frames LzssEncoder writes. A block is decoded once all of it has been
+// pushed. Its output then sits behind the last `max_offset` bytes of history in one window, which only grows
+// with the history and blocks actually received, so no header can make it allocate more than the stream
+// fills. `push` takes no more input while decoded bytes are waiting to be pulled.
+template <typename Codec>
+class LzssDecoder
+{
+private:
+    enum state_t
+    {
+        STATE_HEADER,
+        STATE_BLOCK_HEADER,
+        STATE_BLOCK,
+        STATE_END
+    };
+
+    const Codec &codec;
+
+    state_t state;
+
+    // Bytes of the header or block being received, complete once it holds `needed`.
+    std::vector<uint8_t> input;
+    uint32_t needed;
+
+    uint32_t block_size;
+    uint8_t block_type;
+
+    bool checksums;
+    uint32_t content_checksum;
+
+    // The history, followed by the last decoded block and MATCH_COPY_SLACK bytes.
+    std::vector<uint8_t> window;
+    uint32_t history_length;
+    uint32_t block_length;
+    uint32_t output_position;
+
+    void expect(state_t state, uint32_t needed)
+    {
+        this->state = state;
+        this->needed = needed;
+        this->input.clear();
+    }
+
+    // Makes room for a block of `length` bytes after the history.
+    void reserve_window(uint32_t length)
+    {
+        size_t size = (size_t)this->history_length + length + MATCH_COPY_SLACK;
+
+        if (this->window.size() < size)
+            this->window.resize(size);
+    }
+
+    void step()
+    {
+        switch (this->state)
+        {
+        case STATE_HEADER:
+        {
+            frame_info_t frame = read_frame_header(Span<const uint8_t>(this->input.data(), this->input.size()));
+
+            if (!(frame.flags & FRAME_FLAG_STREAMED) || frame.block_size == 0 ||
+                frame.offset_bits != this->codec.get_offset_bits() || frame.length_bits != this->codec.get_length_bits() || frame.minimum_length != this->codec.get_minimum_length() ||
+                (frame.flags & FORMAT_FLAGS) != this->codec.get_format())
+                throw std::invalid_argument("stream");
+
+            this->checksums = frame.flags & FRAME_FLAG_CHECKSUMS;
+
+            // The header's block size is only a bound, see `reserve_window`.
+            this->block_size = MIN((uint64_t)frame.block_size, this->codec.get_decode_limit());
+            this->expect(STATE_BLOCK_HEADER, 1);
+            break;
+        }
+
+        case STATE_BLOCK_HEADER:
+            if (this->input[0] == BLOCK_TYPE_END && this->checksums && this->input.size() < 1 + CHECKSUM_SIZE)
+                this->needed = 1 + CHECKSUM_SIZE;
+            else if (this->input[0] == BLOCK_TYPE_END)
+            {
+                if (this->checksums && _load_uint32_le(&this->input[1]) != this->content_checksum)
+                    throw std::invalid_argument("checksum");
+
+                this->expect(STATE_END, 0);
+            }
+            else if (this->input[0] != BLOCK_TYPE_LZSS && this->input[0] != BLOCK_TYPE_STORED)
+                throw std::invalid_argument("stream");
+            else if (this->input.size() < STREAM_BLOCK_HEADER_SIZE)
+                this->needed = STREAM_BLOCK_HEADER_SIZE;
+            else
+            {
+                uint32_t size = _load_uint32_le(&this->input[1]);
+
+                if (size == 0 || size > this->codec.get_upper_bound(this->block_size))
+                    throw std::length_error("stream");
+
+                this->block_type = this->input[0];
+                this->expect(STATE_BLOCK, size + (this->checksums ? CHECKSUM_SIZE : 0));
+            }
+            break;
+
+        case STATE_BLOCK:
+        {
+            uint32_t total = this->history_length + this->block_length;
+            uint32_t keep = MIN(total, this->codec.get_max_offset());
+
+            if (keep > 0)
+                memmove(this->window.data(), this->window.data() + total - keep, keep);
+            this->history_length = keep;
+
+            uint32_t length = this->input.size() - (this->checksums ? CHECKSUM_SIZE : 0);
+
+            if (this->block_type == BLOCK_TYPE_STORED)
+            {
+                if (length > this->block_size)
+                    throw std::length_error("stream");
+
+                this->reserve_window(length);
+                memcpy(&this->window[this->history_length], this->input.data(), length);
+            }
+            else
+            {
+                BitStream64 stream(Span<const uint8_t>(this->input.data(), length));
+                uint32_t payload = length;
+                length = stream.read_7bit_uint32();
+
+                if (length > this->block_size || length > this->codec.get_max_decoded_length(payload - stream.read_position()))
+                    throw std::length_error("stream");
+
+                this->reserve_window(length);
+                this->codec.decode_tokens(stream, &this->window[this->history_length], length, this->history_length, true);
+            }
+
+            if (this->checksums)
+            {
+                uint32_t checksum = _load_uint32_le(&this->input[this->input.size() - CHECKSUM_SIZE]);
+
+                verify_checksum(&this->window[this->history_length], length, checksum);
+                this->content_checksum = crc32c_combine(this->content_checksum, checksum, length);
+            }
+
+            this->block_length = length;
+            this->output_position = 0;
+
+            this->expect(STATE_BLOCK_HEADER, 1);
+            break;
+        }
+
+        case STATE_END:
+            break;
+        }
+    }
+
+public:
+    LzssDecoder(const Codec &codec) : codec(codec)
+    {
+        this->block_size = 0;
+        this->block_type = BLOCK_TYPE_LZSS;
+        this->checksums = false;
+        this->content_checksum = 0;
+        this->history_length = 0;
+        this->block_length = 0;
+        this->output_position = 0;
+
+        this->expect(STATE_HEADER, FRAME_HEADER_SIZE);
+    }
+
+    // Takes as much of `input` as it can and returns how many bytes that was. Stops early when a block
+    // was decoded and has to be pulled first, and at the end marker.
+    size_t push(Span<const uint8_t> input)
+    {
+        size_t consumed = 0;
+
+        while (consumed < input.length && this->state != STATE_END && this->output_position == this->block_length)
+        {
+            size_t take = MIN(this->needed - this->input.size(), input.length - consumed);
+
+            this->input.insert(this->input.end(), input.data + consumed, input.data + consumed + take);
+            consumed += take;
+
+            if (this->input.size() == this->needed)
+                this->step();
+        }
+
+        return consumed;
+    }
+
+    // Copies up to `output.length` decoded bytes out and returns how many, 0 once nothing is waiting.
+    size_t pull(Span<uint8_t> output)
+    {
+        size_t count = MIN(output.length, this->block_length - this->output_position);
+
+        if (count > 0)
+            memcpy(output.data, this->window.data() + this->history_length + this->output_position, count);
+        this->output_position += count;
+
+        return count;
+    }
+
+    // True once the end marker was read and every decoded byte has been pulled.
+    bool done() const
+    {
+        return this->state == STATE_END && this->output_position == this->block_length;
+    }
+};
+
+// A file mapped into memory, so the codec reads and writes it in place instead of through a copy.
+// The read-only constructor maps an existing file and hints the kernel that it is read front to back;
+// the writable one creates (or truncates) the file at `length` bytes, call `truncate` once the final size is known.
+class MappedFile
+{
+private:
+    uint8_t *data = NULL;
+    size_t length = 0;
+    bool writable = false;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int file = -1;
+#endif
+
+    void map()
+    {
+        // Empty files can't be mapped, they are just an empty span.
+        if (this->length == 0)
+            return;
+
+#ifdef _WIN32
+        DWORD protection = this->writable ? PAGE_READWRITE : PAGE_READONLY;
+        DWORD access = this->writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+
+        this->mapping = CreateFileMappingA(this->file, NULL, protection, (DWORD)((uint64_t)this->length >> 32), (DWORD)this->length, NULL);
+        if (this->mapping != NULL)
+            this->data = (uint8_t *)MapViewOfFile(this->mapping, access, 0, 0, this->length);
+#else
+        int protection = this->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *address = mmap(NULL, this->length, protection, MAP_SHARED, this->file, 0);
+
+        if (address != MAP_FAILED)
+        {
+            this->data = (uint8_t *)address;
+            madvise(address, this->length, MADV_SEQUENTIAL);
+        }
+#endif
+
+        if (this->data == NULL)
+        {
+            this->close();
+            throw std::logic_error("Could not map file");
+        }
+    }
+
+    void unmap()
+    {
+#ifdef _WIN32
+        if (this->data != NULL)
+            UnmapViewOfFile(this->data);
+        if (this->mapping != NULL)
+            CloseHandle(this->mapping);
+        this->mapping = NULL;
+#else
+        if (this->data != NULL)
+            munmap(this->data, this->length);
+#endif
+        this->data = NULL;
+    }
+
+    void close()
+    {
+        this->unmap();
+
+#ifdef _WIN32
+        if (this->file != INVALID_HANDLE_VALUE)
+            CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+#else
+        if (this->file >= 0)
+            ::close(this->file);
+        this->file = -1;
+#endif
+    }
+
+    void resize(size_t length)
+    {
+#ifdef _WIN32
+        LARGE_INTEGER size;
+        size.QuadPart = length;
+
+        if (!SetFilePointerEx(this->file, size, NULL, FILE_BEGIN) || !SetEndOfFile(this->file))
+#else
+        if (ftruncate(this->file, length) != 0)
+#endif
+        {
+            this->close();
+            throw std::logic_error("Could not resize file");
+        }
+
+        this->length = length;
+    }
+
+public:
+    MappedFile(const char *file_name)
+    {
+#ifdef _WIN32
+        this->file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        LARGE_INTEGER size;
+
+        if (this->file == INVALID_HANDLE_VALUE)
+            throw std::invalid_argument("file_name");
+
+        if (!GetFileSizeEx(this->file, &size))
+        {
+            this->close();
+            throw std::logic_error("Could not map file");
+        }
+
+        this->length = size.QuadPart;
+#else
+        this->file = open(file_name, O_RDONLY);
+        struct stat status;
+
+        if (this->file < 0)
+            throw std::invalid_argument("file_name");
+
+        if (fstat(this->file, &status) != 0)
+        {
+            this->close();
+            throw std::logic_error("Could not map file");
+        }
+
+        this->length = status.st_size;
+#endif
+
+        this->map();
+    }
+
+    MappedFile(const char *file_name, size_t length)
+    {
+        this->writable = true;
+
+#ifdef _WIN32
+        this->file = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+        if (this->file == INVALID_HANDLE_VALUE)
+            throw std::invalid_argument("file_name");
+#else
+        this->file = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (this->file < 0)
+            throw std::invalid_argument("file_name");
+#endif
+
+        this->resize(length);
+        this->map();
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        this->close();
+    }
+
+    size_t size() const { return this->length; }
+
+    Span<const uint8_t> bytes() const { return Span<const uint8_t>(this->data, this->length); }
+
+    Span<uint8_t> writable_bytes()
+    {
+        if (!this->writable)
+            throw std::logic_error("File is mapped read-only");
+
+        return Span<uint8_t>(this->data, this->length);
+    }
+
+    // Shrinks (or grows) a writable file to `length` bytes and remaps it.
+    void truncate(size_t length)
+    {
+        if (!this->writable)
+            throw std::logic_error("File is mapped read-only");
+
+        this->unmap();
+        this->resize(length);
+        this->map();
+    }
+};
+
+#endif
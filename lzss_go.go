@@ -320,7 +320,31 @@ func (l *Lzss) Decode(input []byte) ([]byte, error) {
 	return output, nil
 }
 
+// `-c input output` and `-d input output` encode or decode a single raw stream, for the conformance suite.
+func convertFile(encode bool, inputName, outputName string) {
+	input, err := os.ReadFile(inputName)
+	if err != nil {
+		panic(err)
+	}
+
+	lzss := NewLzss(10, 6, 2)
+
+	output, err := ternary(encode, lzss.Encode, lzss.Decode)(input)
+	if err != nil {
+		panic(err)
+	}
+
+	if err := os.WriteFile(outputName, output, 0644); err != nil {
+		panic(err)
+	}
+}
+
 func main() {
+	if len(os.Args) == 4 && (os.Args[1] == "-c" || os.Args[1] == "-d") {
+		convertFile(os.Args[1] == "-c", os.Args[2], os.Args[3])
+		return
+	}
+
 	if len(os.Args) != 2 {
 		fmt.Println("Was expecting a filename as argument")
 		return
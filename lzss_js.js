@@ -212,6 +212,16 @@ const arraysEqual = (a, b) => {
     return true;
 };
 
+// `-c input output` and `-d input output` encode or decode a single raw stream, for the conformance suite.
+if (process.argv.length == 5 && (process.argv[2] == '-c' || process.argv[2] == '-d')) {
+    const input = new Uint8Array(fs.readFileSync(process.argv[3]));
+
+    const lzss = new Lzss(10, 6, 2);
+
+    fs.writeFileSync(process.argv[4], Buffer.from(process.argv[2] == '-c' ? lzss.encode(input) : lzss.decode(input)));
+    process.exit(0);
+}
+
 if (process.argv.length != 3) {
     console.log('Expected filename');
     process.exit(1);
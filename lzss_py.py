@@ -165,6 +165,17 @@ class Lzss:
 
 import sys
 
+# `-c input output` and `-d input output` encode or decode a single raw stream, for the conformance suite.
+if len(sys.argv) == 4 and sys.argv[1] in ("-c", "-d"):
+    input = open(sys.argv[2], "rb").read()
+
+    lzss = Lzss(10, 6, 2)
+
+    output = lzss.encode(input) if sys.argv[1] == "-c" else lzss.decode(input)
+
+    open(sys.argv[3], "wb").write(bytes(output))
+    sys.exit(0)
+
 if len(sys.argv) != 2:
     print("Expected a filename")
     sys.exit(1)
@@ -259,6 +259,18 @@ fn lzss_decode<'a>(lzss: Lzss, input: &[u8]) -> Vec<u8> {
 fn main() {
     let args: Vec<String> = std::env::args().collect();
 
+    // `-c input output` and `-d input output` encode or decode a single raw stream, for the conformance suite.
+    if args.len() == 4 && (args[1] == "-c" || args[1] == "-d") {
+        let input = std::fs::read(&args[2]).expect("Could not read file");
+
+        let lzss = lzss_new(10, 6, 2);
+
+        let output = if args[1] == "-c" { lzss_encode(lzss, input.as_slice()) } else { lzss_decode(lzss, input.as_slice()) };
+
+        std::fs::write(&args[3], output).expect("Could not write file");
+        return;
+    }
+
     if args.len() != 2 {
         println!("Expected a filename");
         std::process::exit(1);
@@ -0,0 +1,215 @@
+#include "lzss_cpp.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+// How far back repeats between samples are looked for while training, independent of the target window.
+#define TRAIN_OFFSET_BITS 22
+#define TRAIN_CHAIN_DEPTH 256
+
+// Samples are concatenated into one buffer indexed with 32-bit positions.
+#define TRAIN_MAX_CORPUS (1u << 30)
+
+#define DEFAULT_SEGMENT_LENGTH 64
+
+typedef struct train_options_t
+{
+    uint8_t offset_bits = 10;
+    uint8_t length_bits = 6;
+    uint8_t minimum_length = 2;
+
+    // 0 for the codec's whole window, `max_offset` bytes.
+    uint32_t dictionary_size = 0;
+    uint32_t segment_length = DEFAULT_SEGMENT_LENGTH;
+} train_options_t;
+
+typedef struct segment_t
+{
+    uint64_t score;
+    uint32_t start;
+} segment_t;
+
+// Scores every byte of the corpus by how often later samples match it, using the encoder's own hash chain.
+// Only matches the encoder would emit as pairs, and that reach back into an earlier sample, count: a
+// dictionary can't help with what a message already repeats from itself.
+static std::vector<uint32_t> score_corpus(const std::vector<uint8_t> &corpus, const std::vector<uint32_t> &starts, const Lzss &lzss)
+{
+    std::vector<uint32_t> score(corpus.size(), 0);
+
+    uint32_t max_offset = (1u << TRAIN_OFFSET_BITS) - 1;
+    uint32_t maximum_length = (1u << lzss.get_length_bits()) - 1;
+    uint32_t pair_bits = 1 + lzss.get_offset_bits() + lzss.get_length_bits();
+    uint32_t useful_length = MAX(lzss.get_minimum_length(), pair_bits / 9 + 1);
+
+    HashChain chain(TRAIN_OFFSET_BITS, lzss.get_minimum_length());
+    chain.reset(corpus.size());
+
+    for (size_t sample = 0; sample + 1 < starts.size(); sample += 1)
+    {
+        uint32_t start = starts[sample], end = starts[sample + 1];
+        Span<const uint8_t> input(corpus.data(), end);
+
+        // The sample's own positions only go into the chain afterwards, so every match found is to an earlier one.
+        for (uint32_t index = start; index < end;)
+        {
+            match_t match = chain.find(input, index, max_offset, maximum_length, TRAIN_CHAIN_DEPTH);
+
+            if (match.length < useful_length)
+            {
+                index += 1;
+                continue;
+            }
+
+            for (uint32_t i = 0; i < match.length; i += 1)
+                score[index - match.offset + i] += 1;
+
+            index += match.length;
+        }
+
+        for (uint32_t index = start; index < end; index += 1)
+            chain.insert(input, index);
+    }
+
+    return score;
+}
+
+// Picks the best scoring non-overlapping segments until the dictionary is full. The best segment ends up
+// last, since a codec only reaches the last `max_offset` bytes of a dictionary.
+static std::vector<uint8_t> build_dictionary(const std::vector<uint8_t> &corpus, const std::vector<uint32_t> &score, uint32_t size, uint32_t segment_length)
+{
+    std::vector<uint64_t> sums(corpus.size() + 1, 0);
+    for (size_t i = 0; i < corpus.size(); i += 1)
+        sums[i + 1] = sums[i] + score[i];
+
+    std::vector<segment_t> segments;
+    for (uint32_t start = 0; start < corpus.size(); start += 1)
+    {
+        uint32_t end = MIN((size_t)start + segment_length, corpus.size());
+
+        if (score[start] > 0)
+            segments.push_back({sums[end] - sums[start], start});
+    }
+
+    std::sort(segments.begin(), segments.end(), [](const segment_t &a, const segment_t &b)
+    {
+        return a.score != b.score ? a.score > b.score : a.start < b.start;
+    });
+
+    std::vector<bool> used(corpus.size(), false);
+    std::vector<uint8_t> picked;
+
+    for (const segment_t &segment : segments)
+    {
+        if (picked.size() >= size)
+            break;
+
+        uint32_t length = MIN((size_t)segment_length, corpus.size() - segment.start);
+        length = MIN(length, size - (uint32_t)picked.size());
+
+        // Equal-length segments overlap exactly when one contains an end of the other.
+        if (used[segment.start] || used[segment.start + length - 1])
+            continue;
+
+        const uint8_t *bytes = &corpus[segment.start];
+        if (std::search(picked.begin(), picked.end(), bytes, bytes + length) != picked.end())
+            continue;
+
+        std::fill(used.begin() + segment.start, used.begin() + segment.start + length, true);
+        picked.insert(picked.begin(), bytes, bytes + length);
+    }
+
+    return picked;
+}
+
+static void print_usage()
+{
+    std::cout << "Usage: lzss_train [-s size] [-c offset_bits,length_bits,minimum_length] [-k segment_length] dictionary sample...\n";
+}
+
+int main(int argc, const char **argv)
+{
+    train_options_t options;
+    int arg = 1;
+
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        const char *value = argv[arg + 1];
+        unsigned o, l, m;
+
+        if (strcmp(argv[arg], "-s") == 0)
+            options.dictionary_size = strtoul(value, NULL, 10);
+        else if (strcmp(argv[arg], "-k") == 0)
+            options.segment_length = MAX(strtoul(value, NULL, 10), 1ul);
+        else if (strcmp(argv[arg], "-c") == 0 && sscanf(value, "%u,%u,%u", &o, &l, &m) == 3 && o >= 1 && o <= 31 && l >= 1 && l <= 31)
+        {
+            options.offset_bits = o;
+            options.length_bits = l;
+            options.minimum_length = m;
+        }
+        else
+        {
+            print_usage();
+            return -1;
+        }
+    }
+
+    if (argc - arg < 2)
+    {
+        print_usage();
+        return -1;
+    }
+
+    Lzss lzss(options.offset_bits, options.length_bits, options.minimum_length);
+
+    // Bytes past `max_offset` could never be reached by a match.
+    uint32_t size = options.dictionary_size == 0 ? lzss.get_max_offset() : options.dictionary_size;
+    if (size > lzss.get_max_offset())
+    {
+        std::cout << "Dictionary size capped to the " << lzss.get_max_offset() << " byte window\n";
+        size = lzss.get_max_offset();
+    }
+
+    std::vector<uint8_t> corpus;
+    std::vector<uint32_t> starts(1, 0);
+
+    for (int i = arg + 1; i < argc; i += 1)
+    {
+        MappedFile sample(argv[i]);
+        Span<const uint8_t> bytes = sample.bytes();
+
+        if (corpus.size() + bytes.length > TRAIN_MAX_CORPUS)
+        {
+            std::cout << "Corpus limit reached, ignoring " << argv[i] << " and later samples\n";
+            break;
+        }
+
+        corpus.insert(corpus.end(), bytes.data, bytes.data + bytes.length);
+        starts.push_back(corpus.size());
+    }
+
+    std::vector<uint32_t> score = score_corpus(corpus, starts, lzss);
+    std::vector<uint8_t> content = build_dictionary(corpus, score, size, options.segment_length);
+
+    LzssDictionary dictionary(Span<const uint8_t>(content.data(), content.size()));
+
+    {
+        MappedFile output(argv[arg], content.size());
+
+        if (!content.empty())
+            memcpy(output.writable_bytes().data, content.data(), content.size());
+    }
+
+    uint64_t plain = 0, primed = 0;
+    for (size_t sample = 0; sample + 1 < starts.size(); sample += 1)
+    {
+        Span<const uint8_t> input(corpus.data() + starts[sample], starts[sample + 1] - starts[sample]);
+
+        plain += lzss.encode(input).length;
+        primed += lzss.encode(input, dictionary).length;
+    }
+
+    std::cout << "Wrote " << content.size() << " byte dictionary, ID " << dictionary.get_id() << "\n";
+    std::cout << (starts.size() - 1) << " samples, " << corpus.size() << " bytes: " << plain << " compressed, " << primed << " with the dictionary\n";
+
+    return 0;
+}